@@ -0,0 +1,86 @@
+#!/bin/bash
+# Grass のベンチマーク。
+#
+# usage: run-bench.sh [-n RUNS] [PROGRAM.grass...]
+#
+# 各プログラム (省略時はこのディレクトリの *.grass) を、実行エンジンごとに
+# RUNS 回 (省略時は 3 回) 実行し、最短の経過時間を表にする。
+# 最後の列は、 machine で実行した時の --stats (ステップ数、 GC 、
+# ローカルなクロージャ) 。
+#
+# プログラムの入力は、 NAME.in があればそれ、 echo.grass には
+# 生成した 1 MiB のテキスト、それ以外は空。
+#
+# 環境変数:
+# 	GRASS         grass のパス (省略時は ../src/grass)
+# 	GRASS_ENGINES 比べる実行エンジン (省略時は machine jit big-step)
+# 	GRASS_CC, GRASS_CFLAGS, GRASS_LIBS
+# 	              設定されていれば、 --emit-c の出力をこれでコンパイルした
+# 	              ものも比べる (tests/run-tests.sh と同じ) 。
+
+bench_dir=$(cd "$(dirname "$0")" && pwd)
+GRASS=${GRASS:-$bench_dir/../src/grass}
+GRASS_ENGINES=${GRASS_ENGINES:-"machine jit big-step"}
+runs=3
+
+if [ "$1" = "-n" ]; then
+	runs=$2
+	shift 2
+fi
+if [ $# -eq 0 ]; then
+	set -- "$bench_dir"/*.grass
+fi
+
+work=$(mktemp -d "${TMPDIR:-/tmp}/grass-bench.XXXXXX") || exit 1
+trap 'rm -rf "$work"' EXIT
+
+# echo.grass の入力
+yes 'the quick brown fox jumps over the lazy dog' | head -c 1048576 >"$work/text"
+
+# best_time INPUT COMMAND...
+# COMMAND を runs 回実行し、最短の経過時間 (秒) を出力する。
+best_time()
+{
+	local input=$1
+	local best=
+	local i
+	local t
+	shift
+
+	TIMEFORMAT=%R
+	for ((i = 0; i < runs; i++)); do
+		t=$( { time "$@" <"$input" >/dev/null 2>&1; } 2>&1 )
+		if [ -z "$best" ] || awk -v t="$t" -v b="$best" 'BEGIN { exit !(t < b) }'; then
+			best=$t
+		fi
+	done
+	echo "$best"
+}
+
+printf '%-16s %-10s %8s  %s\n' program engine seconds stats
+for program in "$@"; do
+	name=$(basename "$program" .grass)
+	input=/dev/null
+	if [ -f "${program%.grass}.in" ]; then
+		input=${program%.grass}.in
+	elif [ "$name" = echo ]; then
+		input=$work/text
+	fi
+
+	for engine in $GRASS_ENGINES; do
+		stats=
+		if [ "$engine" = machine ]; then
+			stats=$("$GRASS" -S "$program" <"$input" 2>&1 >/dev/null \
+			        | grep -E '^(steps|gc|local):' | tr -s ' \n' ' ' | sed 's/ $//')
+		fi
+		printf '%-16s %-10s %8s  %s\n' "$name" "$engine" \
+		       "$(best_time "$input" "$GRASS" -e "$engine" "$program")" "$stats"
+	done
+
+	if [ -n "$GRASS_CC" ]; then
+		"$GRASS" --emit-c "$program" >"$work/$name.c" \
+		&& eval "$GRASS_CC $GRASS_CFLAGS -o \"\$work/\$name\" \"\$work/\$name.c\" $GRASS_LIBS" \
+		&& printf '%-16s %-10s %8s\n' "$name" emit-c \
+		          "$(best_time "$input" "$work/$name")"
+	fi
+done
@@ -12,8 +12,14 @@
 #define grass_H_
 
 #include "grass_instruction.h"
+#include "grass_bytecode.h"
 #include "grass_value.h"
 #include "grass_parser.h"
 #include "grass_machine.h"
+#include "grass_jit.h"
+#include "grass_emit_c.h"
+#include "grass_eval.h"
+#include "grass_engine.h"
+#include "grass_boehm.h"
 
 #endif /* grass_H_ */
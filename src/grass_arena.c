@@ -0,0 +1,706 @@
+/* $Id$ */
+/*! \file
+ * \brief 抽象機械ごとのヒープ (アリーナ) 。
+ *
+ * \date 2009-01-06
+ * \author yoh2
+ * $LastChangedBy$
+ * $LastChangedDate$
+ */
+
+#include "grass_arena.h"
+#include "grass_value.h"
+#include "grass_machine.h"
+#include "static_assert.h"
+#include <assert.h>
+
+#if defined(GRASS_COMPACT_HEAP)
+
+#include <sys/mman.h>
+
+/*! ブロック番号 b のブロックの先頭のオフセット */
+#define GRASS_ARENA_BLOCK_OFFSET(b) ((size_t)(b) << GRASS_ARENA_BLOCK_SHIFT)
+
+/* 環境スタックのチャンクはブロック1つに置く */
+STATIC_ASSERT(sizeof(struct grass_env_chunk) <= GRASS_ARENA_BLOCK_SIZE);
+
+
+struct grass_arena *grass_current_arena = NULL;
+char *grass_arena_base = NULL;
+
+
+/*! 種類ごとのオブジェクトの大きさ */
+static const size_t grass_arena_object_sizes[GRASS_ARENA_NUM_KINDS] = {
+	GRASS_ARENA_NODE_SIZE,
+	GRASS_ARENA_CLOSURE_SIZE
+};
+
+
+/*!
+ * アリーナが GC に回収される時に、予約したアドレス空間を解放する。
+ */
+static void
+grass_finalize_arena(void *obj, void *client_data)
+{
+	struct grass_arena *arena = (struct grass_arena *)obj;
+
+	(void)client_data;
+	munmap(arena->base, arena->reserved);
+}
+
+
+/*!
+ * 空間 \a space を空にする。ブロックは解放しない。
+ */
+void
+grass_arena_init_space(struct grass_arena_space *space)
+{
+	int kind;
+
+	for(kind = 0; kind < GRASS_ARENA_NUM_KINDS; kind++)
+	{
+		space->bumps[kind].first = GRASS_ARENA_NO_BLOCK;
+		space->bumps[kind].last = GRASS_ARENA_NO_BLOCK;
+		space->bumps[kind].ptr = 0;
+		space->bumps[kind].end = 0;
+	}
+	space->num_blocks = 0;
+}
+
+
+/*!
+ * アリーナを作成する。
+ *
+ * \param limit 上限 (バイト) 。 0 なら GRASS_DEFAULT_ARENA_LIMIT 。
+ *              GRASS_MAX_ARENA_LIMIT を超える場合はそれに切り詰める。
+ *              GC 中は、コピー先としてさらに最大 limit バイトを使う。
+ *
+ * \return 作成したアリーナ。失敗時は NULL (errno が設定される)。
+ */
+struct grass_arena *
+grass_create_arena(size_t limit)
+{
+	struct grass_arena *arena;
+	void *base;
+	size_t max_used_blocks;
+	size_t num_blocks;
+
+	if(limit == 0)
+	{
+		limit = GRASS_DEFAULT_ARENA_LIMIT;
+	}
+	if(limit > GRASS_MAX_ARENA_LIMIT)
+	{
+		limit = GRASS_MAX_ARENA_LIMIT;
+	}
+	max_used_blocks = (limit + GRASS_ARENA_BLOCK_SIZE - 1) >> GRASS_ARENA_BLOCK_SHIFT;
+	/* GC 中のコピー先の分と、使わないブロック 0 の分 */
+	num_blocks = max_used_blocks * 2 + 1;
+
+	arena = (struct grass_arena *)GC_MALLOC(sizeof(*arena));
+	if(arena == NULL)
+	{
+		return NULL;
+	}
+	arena->blocks = (struct grass_arena_block *)GC_MALLOC_ATOMIC(
+	                      num_blocks * sizeof(arena->blocks[0]));
+	if(arena->blocks == NULL)
+	{
+		return NULL;
+	}
+
+	base = mmap(NULL, GRASS_ARENA_BLOCK_OFFSET(num_blocks), PROT_NONE,
+	            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(base == MAP_FAILED)
+	{
+		return NULL;
+	}
+
+	arena->base = (char *)base;
+	arena->reserved = GRASS_ARENA_BLOCK_OFFSET(num_blocks);
+	arena->limit = limit;
+	arena->num_blocks = num_blocks;
+	arena->max_used_blocks = max_used_blocks;
+	arena->num_used_blocks = 0;
+	arena->num_fresh = 1; /* ブロック 0 (オフセット 0 は NULL) は使わない */
+	arena->free_head = GRASS_ARENA_NO_BLOCK;
+	arena->blocks[0].space = GRASS_ARENA_FREE;
+	grass_arena_init_space(&arena->young);
+	grass_arena_init_space(&arena->old);
+	arena->free_objects[GRASS_ARENA_NODE] = 0;
+	arena->free_objects[GRASS_ARENA_CLOSURE] = 0;
+	arena->young_limit = GRASS_ARENA_YOUNG_BLOCKS;
+	if(arena->young_limit > max_used_blocks / 2)
+	{
+		/* 小さなヒープ */
+		arena->young_limit = (max_used_blocks > 2)? max_used_blocks / 2: 1;
+	}
+	arena->major_threshold = GRASS_ARENA_MIN_MAJOR_BLOCKS;
+	arena->collecting = 0;
+	arena->exhausted = 0;
+	arena->num_minor_collections = 0;
+	arena->num_major_collections = 0;
+	arena->gc_seconds = 0.0;
+	arena->gc_max_pause = 0.0;
+	arena->peak_used_blocks = 0;
+	GC_REGISTER_FINALIZER(arena, grass_finalize_arena, NULL, NULL, NULL);
+
+	return arena;
+}
+
+
+/*!
+ * 空きブロックを1つ取り出す。
+ * GC 中でなければ、使用中のブロック数が上限に達している場合は失敗する。
+ *
+ * \return ブロック番号。失敗時は GRASS_ARENA_NO_BLOCK (errno が設定される)。
+ */
+static uint32_t
+grass_arena_take_block(struct grass_arena *arena, enum grass_arena_space_id space)
+{
+	uint32_t block;
+
+	if(!arena->collecting && (arena->num_used_blocks >= arena->max_used_blocks))
+	{
+		arena->exhausted = 1;
+		errno = ENOMEM;
+		return GRASS_ARENA_NO_BLOCK;
+	}
+
+	if(arena->free_head != GRASS_ARENA_NO_BLOCK)
+	{
+		block = arena->free_head;
+		arena->free_head = arena->blocks[block].next;
+	}
+	else
+	{
+		if(arena->num_fresh == arena->num_blocks)
+		{
+			arena->exhausted = 1;
+			errno = ENOMEM;
+			return GRASS_ARENA_NO_BLOCK;
+		}
+		block = (uint32_t)arena->num_fresh;
+		if(mprotect(arena->base + GRASS_ARENA_BLOCK_OFFSET(block), GRASS_ARENA_BLOCK_SIZE,
+		            PROT_READ | PROT_WRITE) != 0)
+		{
+			return GRASS_ARENA_NO_BLOCK;
+		}
+		arena->num_fresh++;
+	}
+
+	arena->blocks[block].space = (unsigned char)space;
+	arena->blocks[block].next = GRASS_ARENA_NO_BLOCK;
+	arena->num_used_blocks++;
+	if(arena->num_used_blocks > arena->peak_used_blocks)
+	{
+		arena->peak_used_blocks = arena->num_used_blocks;
+	}
+
+	return block;
+}
+
+
+/*!
+ * 空間 \a space の \a kind のブロック列の末尾に新しいブロックを繋ぐ。
+ *
+ * \retval zero     失敗。
+ * \retval non-zero 成功。
+ */
+static int
+grass_arena_extend(struct grass_arena *arena, struct grass_arena_space *space,
+                   enum grass_arena_kind kind)
+{
+	struct grass_arena_bump *bump = &space->bumps[kind];
+	uint32_t block;
+
+	block = grass_arena_take_block(arena, (space == &arena->old)? GRASS_ARENA_OLD: GRASS_ARENA_YOUNG);
+	if(block == GRASS_ARENA_NO_BLOCK)
+	{
+		return 0;
+	}
+	arena->blocks[block].kind = (unsigned char)kind;
+
+	if(bump->last == GRASS_ARENA_NO_BLOCK)
+	{
+		bump->first = block;
+	}
+	else
+	{
+		arena->blocks[bump->last].used
+			= (uint32_t)(bump->ptr - GRASS_ARENA_BLOCK_OFFSET(bump->last));
+		arena->blocks[bump->last].next = block;
+	}
+	bump->last = block;
+	bump->ptr = GRASS_ARENA_BLOCK_OFFSET(block);
+	bump->end = bump->ptr + GRASS_ARENA_BLOCK_SIZE
+	          - GRASS_ARENA_BLOCK_SIZE % grass_arena_object_sizes[kind];
+	space->num_blocks++;
+
+	return 1;
+}
+
+
+/*!
+ * 空間 \a space の末尾に \a kind のオブジェクトを確保する。中身は初期化しない。
+ *
+ * \return 確保したオブジェクト。上限に達した場合は NULL を返し、
+ *         errno に ENOMEM を設定する。
+ */
+void *
+grass_arena_alloc_in(struct grass_arena *arena, struct grass_arena_space *space,
+                     enum grass_arena_kind kind)
+{
+	struct grass_arena_bump *bump = &space->bumps[kind];
+	size_t offset;
+
+	if(bump->ptr == bump->end)
+	{
+		if(!grass_arena_extend(arena, space, kind))
+		{
+			return NULL;
+		}
+	}
+	offset = bump->ptr;
+	bump->ptr += grass_arena_object_sizes[kind];
+
+	return arena->base + offset;
+}
+
+
+#if defined(GRASS_REFCOUNT_HEAP)
+
+/*! \brief 参照 \a ref がヒープ上のノード (環境スタック上のセルでないもの) を指すか。 */
+#define GRASS_RC_IS_HEAP_NODE(ref) \
+	(((ref) != GRASS_NO_NODE) \
+	 && (grass_current_arena->blocks[(ref) >> GRASS_ARENA_BLOCK_SHIFT].space != GRASS_ARENA_PINNED))
+
+
+/*!
+ * 参照カウントが 0 になったオブジェクトを空きリストに繋ぐ。
+ * それが指すものの参照カウントは、再利用する時に減らす。
+ *
+ * \param offset オブジェクトのオフセット (ノードの参照かクロージャの値) 。
+ */
+void
+grass_arena_free(struct grass_arena *arena, enum grass_arena_kind kind, uint32_t offset)
+{
+	if(kind == GRASS_ARENA_NODE)
+	{
+		GRASS_NODE_PTR(offset)->refs = arena->free_objects[kind];
+	}
+	else
+	{
+		((struct grass_closure *)GRASS_CLOSURE(offset))->refs = arena->free_objects[kind];
+	}
+	arena->free_objects[kind] = offset;
+}
+
+
+/*!
+ * ヒープ上のノード \a ref の参照カウントを減らす。
+ */
+static void
+grass_rc_release_node(grass_node_ref ref)
+{
+	if((ref != GRASS_NO_NODE) && (--GRASS_NODE_PTR(ref)->refs == 0))
+	{
+		grass_arena_free(grass_current_arena, GRASS_ARENA_NODE, ref);
+	}
+}
+
+
+/*!
+ * ヒープ上のノード \a node が指すものの参照カウントを減らす。
+ * (ヒープ上のノードは環境スタック上のセルを指さない)
+ */
+static void
+grass_rc_release_heap_node(struct grass_value_node *node)
+{
+	GRASS_RC_RELEASE_VALUE(node->value);
+	grass_rc_release_node(node->left);
+	grass_rc_release_node(node->right);
+	grass_rc_release_node(node->rest);
+}
+
+
+/*!
+ * ノード \a node が指すものの参照カウントを増やす。
+ * \a node は環境スタック上のセルでもよい。その場合、同じスタック上の
+ * セルへの参照は数えない。
+ */
+void
+grass_rc_retain_cell(struct grass_value_node *node)
+{
+	GRASS_RC_RETAIN_VALUE(node->value);
+	if(GRASS_RC_IS_HEAP_NODE(node->left))
+	{
+		GRASS_NODE_PTR(node->left)->refs++;
+	}
+	if(GRASS_RC_IS_HEAP_NODE(node->right))
+	{
+		GRASS_NODE_PTR(node->right)->refs++;
+	}
+	if(GRASS_RC_IS_HEAP_NODE(node->rest))
+	{
+		GRASS_NODE_PTR(node->rest)->refs++;
+	}
+}
+
+
+/*!
+ * 環境スタックから捨てるセル \a cell が指すものの参照カウントを減らす。
+ */
+void
+grass_rc_release_cell(struct grass_value_node *cell)
+{
+	GRASS_RC_RELEASE_VALUE(cell->value);
+	if(GRASS_RC_IS_HEAP_NODE(cell->left))
+	{
+		grass_rc_release_node(cell->left);
+	}
+	if(GRASS_RC_IS_HEAP_NODE(cell->right))
+	{
+		grass_rc_release_node(cell->right);
+	}
+	if(GRASS_RC_IS_HEAP_NODE(cell->rest))
+	{
+		grass_rc_release_node(cell->rest);
+	}
+}
+
+#endif /* defined(GRASS_REFCOUNT_HEAP) */
+
+
+/*!
+ * 若い世代に \a kind のオブジェクトを確保する。中身は初期化しない。
+ * GC はここでは行わず、安全な位置で grass_collect_garbage() を呼ぶ。
+ *
+ * \return 確保したオブジェクト。上限に達した場合は NULL を返し、
+ *         errno に ENOMEM を設定する。
+ */
+void *
+grass_arena_alloc(struct grass_arena *arena, enum grass_arena_kind kind)
+{
+#if defined(GRASS_REFCOUNT_HEAP)
+	uint32_t offset;
+#endif
+
+	assert(arena != NULL);
+
+#if defined(GRASS_REFCOUNT_HEAP)
+	offset = arena->free_objects[kind];
+	if(offset != 0)
+	{
+		/* 解放済みのオブジェクトを再利用する。
+		 * 遅らせていた、それが指すものの参照カウントの減算をここで行う。 */
+		if(kind == GRASS_ARENA_NODE)
+		{
+			struct grass_value_node *node = GRASS_NODE_PTR(offset);
+
+			arena->free_objects[kind] = node->refs;
+			grass_rc_release_heap_node(node);
+			node->refs = 0;
+			return node;
+		}
+		else
+		{
+			struct grass_closure *closure = (struct grass_closure *)GRASS_CLOSURE(offset);
+
+			arena->free_objects[kind] = closure->refs;
+			grass_rc_release_node(closure->env);
+			closure->refs = 0;
+			return closure;
+		}
+	}
+	else
+	{
+		void *obj = grass_arena_alloc_in(arena, &arena->young, kind);
+
+		if(obj != NULL)
+		{
+			if(kind == GRASS_ARENA_NODE)
+			{
+				((struct grass_value_node *)obj)->refs = 0;
+			}
+			else
+			{
+				((struct grass_closure *)obj)->refs = 0;
+			}
+		}
+		return obj;
+	}
+#else
+	return grass_arena_alloc_in(arena, &arena->young, kind);
+#endif
+}
+
+
+/*!
+ * GC が動かさず、回収もしないオブジェクトを確保する。
+ * オブジェクトはブロックを1つ占める。中身は初期化しない。
+ *
+ * \param size 大きさ。 GRASS_ARENA_BLOCK_SIZE 以下であること。
+ *
+ * \return 確保したオブジェクト。上限に達した場合は NULL を返し、
+ *         errno に ENOMEM を設定する。
+ */
+void *
+grass_arena_alloc_pinned(struct grass_arena *arena, size_t size)
+{
+	uint32_t block;
+
+	assert(arena != NULL);
+	assert(size <= GRASS_ARENA_BLOCK_SIZE);
+	(void)size;
+
+	block = grass_arena_take_block(arena, GRASS_ARENA_PINNED);
+	if(block == GRASS_ARENA_NO_BLOCK)
+	{
+		return NULL;
+	}
+
+	return arena->base + GRASS_ARENA_BLOCK_OFFSET(block);
+}
+
+
+/*!
+ * 空間 \a space のブロックを全て空きブロックに戻し、 \a space を空にする。
+ *
+ * \param decommit 非ゼロなら、ブロックの物理メモリを OS に返す。
+ */
+void
+grass_arena_release_space(struct grass_arena *arena, struct grass_arena_space *space,
+                          int decommit)
+{
+	int kind;
+
+	for(kind = 0; kind < GRASS_ARENA_NUM_KINDS; kind++)
+	{
+		uint32_t block = space->bumps[kind].first;
+
+		while(block != GRASS_ARENA_NO_BLOCK)
+		{
+			uint32_t next = arena->blocks[block].next;
+
+			if(decommit)
+			{
+				madvise(arena->base + GRASS_ARENA_BLOCK_OFFSET(block),
+				        GRASS_ARENA_BLOCK_SIZE, MADV_DONTNEED);
+			}
+			arena->blocks[block].space = GRASS_ARENA_FREE;
+			arena->blocks[block].next = arena->free_head;
+			arena->free_head = block;
+			arena->num_used_blocks--;
+
+			block = next;
+		}
+	}
+	grass_arena_init_space(space);
+}
+
+
+/*!
+ * 以後、 \a arena を現在のアリーナとして使う。
+ * オブジェクトの確保と、オフセットからのポインタの復元は現在のアリーナで行う。
+ * 抽象機械は実行を始める時にこれを呼ぶ。
+ */
+void
+grass_enter_arena(struct grass_arena *arena)
+{
+	assert(arena != NULL);
+
+	grass_current_arena = arena;
+	grass_arena_base = arena->base;
+}
+
+
+/*!
+ * \a arena からの確保に失敗した時のエラーの説明。
+ */
+char *
+grass_arena_error_message(const struct grass_arena *arena)
+{
+	if(arena->exhausted)
+	{
+		return "runtime error: heap limit exceeded.";
+	}
+
+	return strerror(errno);
+}
+
+#else /* defined(GRASS_COMPACT_HEAP) */
+
+#include <gc/gc_typed.h>
+#include <stddef.h>
+
+/*
+ * 型記述子は、以下の構造体の語の並びに合わせて作る。欄を足したり並べ替えたり
+ * したら、 grass_set_node_bits() と grass_make_descrs() も直すこと。
+ * ポインタの欄が記述子から漏れると、 GC がその先を回収してしまう。
+ */
+/* grass_value_node: value, left, right, rest (ポインタ), size (整数) */
+STATIC_ASSERT(sizeof(grass_value) == sizeof(GC_word));
+STATIC_ASSERT(offsetof(struct grass_value_node, rest) == 3 * sizeof(GC_word));
+STATIC_ASSERT(offsetof(struct grass_value_node, size) == 4 * sizeof(GC_word));
+STATIC_ASSERT(sizeof(struct grass_value_node) == 5 * sizeof(GC_word));
+/* grass_closure: code, num_args (整数), env (ポインタ) */
+STATIC_ASSERT(offsetof(struct grass_closure, env) == 2 * sizeof(GC_word));
+STATIC_ASSERT(sizeof(struct grass_closure) == 3 * sizeof(GC_word));
+/* grass_env_chunk: prev, next (ポインタ), index (整数), cells */
+STATIC_ASSERT(offsetof(struct grass_env_chunk, index) == 2 * sizeof(GC_word));
+STATIC_ASSERT(offsetof(struct grass_env_chunk, cells) == 3 * sizeof(GC_word));
+STATIC_ASSERT(sizeof(struct grass_env_chunk)
+              == 3 * sizeof(GC_word) + GRASS_ENV_CHUNK_CELLS * sizeof(struct grass_value_node));
+/* grass_closure_chunk: next (ポインタ), closures */
+STATIC_ASSERT(offsetof(struct grass_closure_chunk, closures) == sizeof(GC_word));
+STATIC_ASSERT(sizeof(struct grass_closure_chunk)
+              == sizeof(GC_word) + GRASS_CLOSURE_CHUNK_CLOSURES * sizeof(struct grass_closure));
+
+/*
+ * Boehm GC の型記述子。最初の確保の時に作る。
+ * 値はタグ付きでも、クロージャならそのままポインタなので辿る対象に含める。
+ */
+static GC_descr grass_node_descr;
+static GC_descr grass_closure_descr;
+static GC_descr grass_env_chunk_descr;
+static GC_descr grass_closure_chunk_descr;
+static int grass_descrs_ready = 0;
+
+
+/*!
+ * grass_value_node 中のポインタの位置を \a bitmap の \a offset 語目から立てる。
+ */
+static void
+grass_set_node_bits(GC_word *bitmap, size_t offset)
+{
+	GC_set_bit(bitmap, offset + GC_WORD_OFFSET(struct grass_value_node, value));
+	GC_set_bit(bitmap, offset + GC_WORD_OFFSET(struct grass_value_node, left));
+	GC_set_bit(bitmap, offset + GC_WORD_OFFSET(struct grass_value_node, right));
+	GC_set_bit(bitmap, offset + GC_WORD_OFFSET(struct grass_value_node, rest));
+}
+
+
+/*!
+ * 型記述子を作る。 size などの整数の欄は辿らない。
+ */
+static void
+grass_make_descrs(void)
+{
+	GC_word node_bitmap[GC_BITMAP_SIZE(struct grass_value_node)];
+	GC_word closure_bitmap[GC_BITMAP_SIZE(struct grass_closure)];
+	GC_word chunk_bitmap[GC_BITMAP_SIZE(struct grass_env_chunk)];
+	GC_word closure_chunk_bitmap[GC_BITMAP_SIZE(struct grass_closure_chunk)];
+	size_t i;
+
+	memset(node_bitmap, 0, sizeof(node_bitmap));
+	grass_set_node_bits(node_bitmap, 0);
+	grass_node_descr = GC_make_descriptor(node_bitmap,
+	                                      GC_WORD_LEN(struct grass_value_node));
+
+	memset(closure_bitmap, 0, sizeof(closure_bitmap));
+	GC_set_bit(closure_bitmap, GC_WORD_OFFSET(struct grass_closure, env));
+	grass_closure_descr = GC_make_descriptor(closure_bitmap,
+	                                         GC_WORD_LEN(struct grass_closure));
+
+	memset(chunk_bitmap, 0, sizeof(chunk_bitmap));
+	GC_set_bit(chunk_bitmap, GC_WORD_OFFSET(struct grass_env_chunk, prev));
+	GC_set_bit(chunk_bitmap, GC_WORD_OFFSET(struct grass_env_chunk, next));
+	for(i = 0; i < GRASS_ENV_CHUNK_CELLS; i++)
+	{
+		grass_set_node_bits(chunk_bitmap,
+		                    GC_WORD_OFFSET(struct grass_env_chunk, cells)
+		                    + i * GC_WORD_LEN(struct grass_value_node));
+	}
+	grass_env_chunk_descr = GC_make_descriptor(chunk_bitmap,
+	                                           GC_WORD_LEN(struct grass_env_chunk));
+
+	memset(closure_chunk_bitmap, 0, sizeof(closure_chunk_bitmap));
+	GC_set_bit(closure_chunk_bitmap, GC_WORD_OFFSET(struct grass_closure_chunk, next));
+	for(i = 0; i < GRASS_CLOSURE_CHUNK_CLOSURES; i++)
+	{
+		GC_set_bit(closure_chunk_bitmap,
+		           GC_WORD_OFFSET(struct grass_closure_chunk, closures)
+		           + i * GC_WORD_LEN(struct grass_closure)
+		           + GC_WORD_OFFSET(struct grass_closure, env));
+	}
+	grass_closure_chunk_descr = GC_make_descriptor(closure_chunk_bitmap,
+	                                               GC_WORD_LEN(struct grass_closure_chunk));
+
+	grass_descrs_ready = 1;
+}
+
+
+/*!
+ * GC のヒープに grass_value_node を確保する。中身は初期化しない。
+ *
+ * \return 確保したノード。失敗時は NULL 。
+ */
+struct grass_value_node *
+grass_gc_alloc_node(void)
+{
+	if(!grass_descrs_ready)
+	{
+		grass_make_descrs();
+	}
+
+	return (struct grass_value_node *)GC_MALLOC_EXPLICITLY_TYPED(
+	               sizeof(struct grass_value_node), grass_node_descr);
+}
+
+
+/*!
+ * GC のヒープに grass_closure を確保する。中身は初期化しない。
+ * code と num_args は辿らない。
+ *
+ * \return 確保したクロージャ。失敗時は NULL 。
+ */
+struct grass_closure *
+grass_gc_alloc_closure(void)
+{
+	if(!grass_descrs_ready)
+	{
+		grass_make_descrs();
+	}
+
+	return (struct grass_closure *)GC_MALLOC_EXPLICITLY_TYPED(
+	               sizeof(struct grass_closure), grass_closure_descr);
+}
+
+
+/*!
+ * GC のヒープに環境スタックのチャンクを確保する。中身は初期化しない。
+ *
+ * \return 確保したチャンク。失敗時は NULL 。
+ */
+struct grass_env_chunk *
+grass_gc_alloc_env_chunk(void)
+{
+	if(!grass_descrs_ready)
+	{
+		grass_make_descrs();
+	}
+
+	return (struct grass_env_chunk *)GC_MALLOC_EXPLICITLY_TYPED(
+	               sizeof(struct grass_env_chunk), grass_env_chunk_descr);
+}
+
+
+/*!
+ * GC のヒープにクロージャスタックのチャンクを確保する。中身は初期化しない。
+ *
+ * \return 確保したチャンク。失敗時は NULL 。
+ */
+struct grass_closure_chunk *
+grass_gc_alloc_closure_chunk(void)
+{
+	if(!grass_descrs_ready)
+	{
+		grass_make_descrs();
+	}
+
+	return (struct grass_closure_chunk *)GC_MALLOC_EXPLICITLY_TYPED(
+	               sizeof(struct grass_closure_chunk), grass_closure_chunk_descr);
+}
+
+#endif /* defined(GRASS_COMPACT_HEAP) */
@@ -0,0 +1,301 @@
+/* $Id$ */
+/*! \file
+ * \brief 抽象機械ごとのヒープ (アリーナ) 。
+ *
+ * GRASS_COMPACT_HEAP を定義してビルドした場合 (configure --enable-compact-heap) 、
+ * 値、環境のセル、クロージャは抽象機械ごとのアリーナに確保され、
+ * ポインタの代わりにアリーナ先頭からの32ビットのオフセットで互いを参照する
+ * (grass_value.h 参照)。アリーナのゴミは grass_gc.c のコピー GC が集める。
+ * 生きているオブジェクトが上限を超えた場合は "heap limit exceeded" のエラーになる。
+ *
+ * アリーナは固定長のブロックに分かれ、各ブロックには1種類のオブジェクト
+ * (grass_value_node か grass_closure) だけが並ぶ。そのため、オブジェクトに
+ * ヘッダを付けなくても、オフセットから種類と大きさがわかる。
+ * 環境スタックのチャンクは動かさないブロック (GRASS_ARENA_PINNED) に置く。
+ *
+ * GRASS_REFCOUNT_HEAP も定義した場合 (configure --enable-refcount) 、GC の代わりに
+ * 参照カウントでオブジェクトを解放する。数えるのはヒープ上のオブジェクトと
+ * 環境スタック上のセルからの参照で、抽象機械のレジスタ (env, Dump) は数えない。
+ * カウントが 0 になったオブジェクトはすぐに種類ごとの空きリストに繋ぐが、
+ * それが指すものの参照カウントを減らすのは、そのオブジェクトを再利用する時まで
+ * 遅らせる。そのため、解放の連鎖で止まることはなく、確保1回あたりの手間は
+ * 定数で抑えられる。 Grass のオブジェクトは自分より古いものしか指さないので、
+ * 循環は生じない。
+ *
+ * そうでない場合、ヒープは Boehm GC のもので、アリーナは使われない。
+ * オブジェクトはポインタの位置を示す型記述子付きで確保し、 GC が
+ * size などの整数をポインタとみなして辿らないようにする。
+ *
+ * \date 2009-01-06
+ * \author yoh2
+ * $LastChangedBy$
+ * $LastChangedDate$
+ */
+#ifndef grass_arena_H_
+#define grass_arena_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <gc.h>
+#include "grass_fwd.h"
+#include "grass_value.h"
+
+#if defined(GRASS_REFCOUNT_HEAP) && !defined(GRASS_COMPACT_HEAP)
+#error "GRASS_REFCOUNT_HEAP requires GRASS_COMPACT_HEAP."
+#endif
+
+/*! アリーナの上限の既定値 (バイト) 。 */
+#define GRASS_DEFAULT_ARENA_LIMIT ((size_t)256 << 20)
+
+/*!
+ * アリーナの上限の最大値。
+ * コピー中は上限の倍まで使うことがあり、それがオフセットの32ビットに収まる範囲。
+ */
+#define GRASS_MAX_ARENA_LIMIT ((size_t)2047 << 20)
+
+/*! ブロックの大きさ (2 の冪) 。 */
+#define GRASS_ARENA_BLOCK_SHIFT 16
+#define GRASS_ARENA_BLOCK_SIZE ((size_t)1 << GRASS_ARENA_BLOCK_SHIFT)
+
+/*! 若い世代のブロック数の上限の既定値 */
+#define GRASS_ARENA_YOUNG_BLOCKS 32
+
+/*! 全体の GC を始める、古い世代のブロック数の最小値 */
+#define GRASS_ARENA_MIN_MAJOR_BLOCKS 128
+
+/*! ノードの大きさ */
+#define GRASS_ARENA_NODE_SIZE sizeof(struct grass_value_node)
+/*! クロージャの大きさ。クロージャの値はタグが 0 なので 8 バイト境界に置く。 */
+#define GRASS_ARENA_CLOSURE_SIZE ((sizeof(struct grass_closure) + 7) & ~(size_t)7)
+
+/*! ブロックが無いことを表すブロック番号。 (ブロック 0 はオフセット 0 を含むので使わない) */
+#define GRASS_ARENA_NO_BLOCK 0
+
+/*! ブロックに並ぶオブジェクトの種類。 */
+enum grass_arena_kind
+{
+	GRASS_ARENA_NODE,    /*!< \brief grass_value_node */
+	GRASS_ARENA_CLOSURE, /*!< \brief grass_closure */
+	GRASS_ARENA_NUM_KINDS
+};
+
+/*! ブロックの所属。 */
+enum grass_arena_space_id
+{
+	GRASS_ARENA_FREE,   /*!< \brief 未使用 */
+	GRASS_ARENA_YOUNG,  /*!< \brief 若い世代 (新しく確保したオブジェクト) */
+	GRASS_ARENA_OLD,    /*!< \brief 古い世代 (GC を生き延びたオブジェクト) */
+	GRASS_ARENA_FROM,   /*!< \brief GC 中のコピー元 */
+	GRASS_ARENA_PINNED  /*!< \brief 動かさないもの (環境スタックのチャンク) */
+};
+
+/*! ブロックの情報。 */
+struct grass_arena_block
+{
+	unsigned char space; /*!< \brief enum grass_arena_space_id */
+	unsigned char kind;  /*!< \brief enum grass_arena_kind */
+	uint32_t next;       /*!< \brief 同じ空間、同じ種類の次のブロック。空きブロックなら次の空き */
+	uint32_t used;       /*!< \brief 使用済みのバイト数。確保中のブロックでは未設定 */
+};
+
+/*! 空間の中の、1種類のオブジェクトの確保位置。 */
+struct grass_arena_bump
+{
+	uint32_t first; /*!< \brief 最初のブロック */
+	uint32_t last;  /*!< \brief 確保中のブロック */
+	size_t ptr;     /*!< \brief 次に確保するオフセット */
+	size_t end;     /*!< \brief 確保中のブロックの終わりのオフセット */
+};
+
+/*! 世代。オブジェクトの種類ごとにブロックの列を持つ。 */
+struct grass_arena_space
+{
+	struct grass_arena_bump bumps[GRASS_ARENA_NUM_KINDS];
+	size_t num_blocks;
+};
+
+/*!
+ * アリーナ。
+ * 上限の倍 (コピー先の分) のアドレス空間を最初に予約し、ブロックを使う時に
+ * 読み書きできるようにする。アリーナ自体が GC に回収される時に解放される。
+ */
+struct grass_arena
+{
+	char *base;       /*!< \brief 先頭。オフセット 0 は NULL を表すので使わない */
+	size_t reserved;  /*!< \brief 予約したバイト数 */
+	size_t limit;     /*!< \brief 上限 (バイト) */
+
+	struct grass_arena_block *blocks; /*!< \brief ブロックの情報。要素数は reserved のブロック数 */
+	size_t num_blocks;      /*!< \brief blocks の要素数 */
+	size_t max_used_blocks; /*!< \brief GC 中以外に使えるブロック数 (上限) */
+	size_t num_used_blocks; /*!< \brief 使用中のブロック数 */
+	size_t num_fresh;       /*!< \brief まだ一度も使っていない最初のブロック */
+	uint32_t free_head;     /*!< \brief 空きブロックのリスト */
+
+	struct grass_arena_space young;
+	struct grass_arena_space old;
+	size_t young_limit;     /*!< \brief young がこのブロック数に達したら GC する (作成時に決まる) */
+	size_t major_threshold; /*!< \brief old がこのブロック数に達したら全体を GC する */
+	int collecting;         /*!< \brief GC 中か (上限を超えて確保できる) */
+	int exhausted;          /*!< \brief 上限に達して確保に失敗したか */
+
+	/*! 参照カウントが 0 になったオブジェクトの、種類ごとのリスト。 refs で繋ぐ。 */
+	uint32_t free_objects[GRASS_ARENA_NUM_KINDS];
+
+	size_t num_minor_collections; /*!< \brief 若い世代だけの GC の回数 */
+	size_t num_major_collections; /*!< \brief 全体の GC の回数 */
+	double gc_seconds;            /*!< \brief GC にかかった CPU 時間 */
+	double gc_max_pause;          /*!< \brief GC 1回にかかった CPU 時間の最大値 */
+	size_t peak_used_blocks;      /*!< \brief 使用中のブロック数の最大値 */
+};
+
+
+#if defined(GRASS_COMPACT_HEAP)
+
+/*! 現在のアリーナ。 grass_enter_arena() で切り替える。 */
+extern struct grass_arena *grass_current_arena;
+
+/*! \brief ヒープに grass_value_node を確保する。 */
+#define GRASS_ALLOC_NODE() \
+	((struct grass_value_node *)grass_arena_alloc(grass_current_arena, GRASS_ARENA_NODE))
+
+/*! \brief ヒープに grass_closure を確保する。 */
+#define GRASS_ALLOC_CLOSURE() \
+	((struct grass_closure *)grass_arena_alloc(grass_current_arena, GRASS_ARENA_CLOSURE))
+
+/*! \brief ヒープに、 GC が動かさない環境スタックのチャンクを確保する。 */
+#define GRASS_ALLOC_ENV_CHUNK()                                            \
+	((struct grass_env_chunk *)grass_arena_alloc_pinned(grass_current_arena, \
+	                                                    sizeof(struct grass_env_chunk)))
+
+/*! \brief ヒープの確保に失敗した時のエラーの説明。 */
+#define GRASS_HEAP_ERROR_MESSAGE() grass_arena_error_message(grass_current_arena)
+
+/*! \brief 若い世代が一杯になり、 GC すべきか。 */
+#define GRASS_ARENA_SHOULD_COLLECT(arena) \
+	((arena)->young.num_blocks >= (arena)->young_limit)
+
+#if defined(GRASS_REFCOUNT_HEAP)
+
+/*! \brief クロージャの値 \a v の参照カウントを増やす。 */
+#define GRASS_RC_RETAIN_VALUE(v)                                                   \
+	do                                                                         \
+	{                                                                          \
+		if(GRASS_IS_CLOSURE(v) && ((v) != GRASS_NO_VALUE))                 \
+		{                                                                  \
+			((struct grass_closure *)GRASS_CLOSURE(v))->refs++;        \
+		}                                                                  \
+	}while(0)
+
+/*! \brief クロージャの値 \a v の参照カウントを減らす。 */
+#define GRASS_RC_RELEASE_VALUE(v)                                                  \
+	do                                                                         \
+	{                                                                          \
+		if(GRASS_IS_CLOSURE(v) && ((v) != GRASS_NO_VALUE)                  \
+		&& (--((struct grass_closure *)GRASS_CLOSURE(v))->refs == 0))      \
+		{                                                                  \
+			grass_arena_free(grass_current_arena, GRASS_ARENA_CLOSURE, \
+			                 (v));                                     \
+		}                                                                  \
+	}while(0)
+
+/*! \brief ヒープ上のノード \a node (NULL でもよい) の参照カウントを増やす。 */
+#define GRASS_RC_RETAIN_NODE(node)                                                 \
+	do                                                                         \
+	{                                                                          \
+		if((node) != NULL)                                                 \
+		{                                                                  \
+			(node)->refs++;                                            \
+		}                                                                  \
+	}while(0)
+
+/*! \brief ノード (環境スタック上のセルを含む) \a node が指すものの参照カウントを増やす。 */
+#define GRASS_RC_RETAIN_CELL(node) grass_rc_retain_cell(node)
+
+/*! \brief 環境スタック上のセル \a cell が指すものの参照カウントを減らす。 */
+#define GRASS_RC_RELEASE_CELL(cell) grass_rc_release_cell(cell)
+
+/* オブジェクトを空きリストに繋ぐ。 */
+void
+grass_arena_free(struct grass_arena *arena, enum grass_arena_kind kind, uint32_t offset);
+
+/* ノードが指すものの参照カウントを増やす。 */
+void
+grass_rc_retain_cell(struct grass_value_node *node);
+
+/* 環境スタック上のセルが指すものの参照カウントを減らす。 */
+void
+grass_rc_release_cell(struct grass_value_node *cell);
+
+#endif /* defined(GRASS_REFCOUNT_HEAP) */
+
+/* アリーナを作成する。 */
+struct grass_arena *
+grass_create_arena(size_t limit);
+
+/* 空間を空にする。 */
+void
+grass_arena_init_space(struct grass_arena_space *space);
+
+/* 若い世代にオブジェクトを確保する。 */
+void *
+grass_arena_alloc(struct grass_arena *arena, enum grass_arena_kind kind);
+
+/* 空間 space の末尾にオブジェクトを確保する。 */
+void *
+grass_arena_alloc_in(struct grass_arena *arena, struct grass_arena_space *space,
+                     enum grass_arena_kind kind);
+
+/* GC が動かさないオブジェクトを確保する。 */
+void *
+grass_arena_alloc_pinned(struct grass_arena *arena, size_t size);
+
+/* 空間 space のブロックを全て空きブロックに戻す。 */
+void
+grass_arena_release_space(struct grass_arena *arena, struct grass_arena_space *space,
+                          int decommit);
+
+/* 以後、 arena を現在のアリーナとして使う。 */
+void
+grass_enter_arena(struct grass_arena *arena);
+
+/* アリーナからの確保に失敗した時のエラーの説明。 */
+char *
+grass_arena_error_message(const struct grass_arena *arena);
+
+#else /* defined(GRASS_COMPACT_HEAP) */
+
+#define GRASS_ALLOC_NODE() grass_gc_alloc_node()
+#define GRASS_ALLOC_CLOSURE() grass_gc_alloc_closure()
+#define GRASS_ALLOC_ENV_CHUNK() grass_gc_alloc_env_chunk()
+#define GRASS_HEAP_ERROR_MESSAGE() strerror(errno)
+
+/* GC のヒープに grass_value_node を確保する。 */
+struct grass_value_node *
+grass_gc_alloc_node(void);
+
+/* GC のヒープに grass_closure を確保する。 */
+struct grass_closure *
+grass_gc_alloc_closure(void);
+
+/* GC のヒープに環境スタックのチャンクを確保する。 */
+struct grass_env_chunk *
+grass_gc_alloc_env_chunk(void);
+
+/* GC のヒープにクロージャスタックのチャンクを確保する。 */
+struct grass_closure_chunk *
+grass_gc_alloc_closure_chunk(void);
+
+#endif /* defined(GRASS_COMPACT_HEAP) */
+
+#if !defined(GRASS_REFCOUNT_HEAP)
+#define GRASS_RC_RETAIN_VALUE(v) ((void)0)
+#define GRASS_RC_RELEASE_VALUE(v) ((void)0)
+#define GRASS_RC_RETAIN_NODE(node) ((void)0)
+#define GRASS_RC_RETAIN_CELL(node) ((void)0)
+#define GRASS_RC_RELEASE_CELL(cell) ((void)0)
+#endif
+
+#endif /* grass_arena_H_ */
@@ -0,0 +1,264 @@
+/* $Id$ */
+/*! \file
+ * \brief Boehm GC の設定と統計。
+ *
+ * \date 2009-01-06
+ * \author yoh2
+ * $LastChangedBy$
+ * $LastChangedDate$
+ */
+
+#include "grass_boehm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <gc.h>
+#include <assert.h>
+
+
+/*! grass_init_gc() 以降の統計。 */
+static struct grass_gc_stats grass_gc_totals;
+
+#if defined(HAVE_GC_SET_ON_COLLECTION_EVENT)
+/*! 実行中の GC の開始時刻 */
+static double grass_gc_start;
+
+/*! 実行中の GC のマークの開始時刻 */
+static double grass_gc_mark_start;
+#else
+/*! grass_init_gc() の時点の GC の回数 */
+static GC_word grass_gc_first_no;
+#endif
+
+
+#if defined(HAVE_GC_SET_ON_COLLECTION_EVENT)
+/*!
+ * 現在の時刻 (秒) 。 GC の停止時間は、マークを並列に行うと CPU 時間とは
+ * 合わないので、実時間で測る。
+ */
+static double
+grass_gc_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+
+/*!
+ * GC の開始と終了、マークの開始と終了で Boehm GC から呼ばれ、統計を取る。
+ * アロケーションのロックを持ったまま呼ばれるので、確保はしないこと。
+ */
+static void
+grass_on_gc_event(GC_EventType event)
+{
+	double seconds;
+	size_t heap_size;
+
+	switch(event)
+	{
+	case GC_EVENT_START:
+		grass_gc_start = grass_gc_now();
+		break;
+
+	case GC_EVENT_MARK_START:
+		grass_gc_mark_start = grass_gc_now();
+		break;
+
+	case GC_EVENT_MARK_END:
+		grass_gc_totals.mark_seconds += grass_gc_now() - grass_gc_mark_start;
+		break;
+
+	case GC_EVENT_END:
+		seconds = grass_gc_now() - grass_gc_start;
+		grass_gc_totals.collections++;
+		grass_gc_totals.seconds += seconds;
+		if(seconds > grass_gc_totals.max_pause)
+		{
+			grass_gc_totals.max_pause = seconds;
+		}
+		heap_size = GC_get_heap_size();
+		if(heap_size > grass_gc_totals.peak_heap)
+		{
+			grass_gc_totals.peak_heap = heap_size;
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+#endif /* HAVE_GC_SET_ON_COLLECTION_EVENT */
+
+
+/*!
+ * バイト数を解析する。 k, m, g の接尾辞はそれぞれ 2^10, 2^20, 2^30 倍を表す。
+ *
+ * \retval zero     不正な値。
+ * \retval non-zero 成功。 \a result に値が格納される。
+ */
+int
+grass_parse_size(const char *arg, size_t *result)
+{
+	unsigned long n;
+	char *end;
+	int shift = 0;
+
+	errno = 0;
+	n = strtoul(arg, &end, 10);
+	if((*arg == '\0') || (errno != 0))
+	{
+		return 0;
+	}
+
+	switch(*end)
+	{
+	case 'k': case 'K': shift = 10; end++; break;
+	case 'm': case 'M': shift = 20; end++; break;
+	case 'g': case 'G': shift = 30; end++; break;
+	}
+	if((*end != '\0') || (n > ((size_t)-1 >> shift)))
+	{
+		return 0;
+	}
+
+	*result = (size_t)n << shift;
+	return 1;
+}
+
+
+/*!
+ * 0 以上の整数を解析する。
+ *
+ * \retval zero     不正な値。
+ * \retval non-zero 成功。 \a result に値が格納される。
+ */
+int
+grass_parse_count(const char *arg, unsigned int *result)
+{
+	unsigned long n;
+	char *end;
+
+	errno = 0;
+	n = strtoul(arg, &end, 10);
+	if((*arg == '\0') || (*end != '\0') || (errno != 0) || (n > 0xffffu))
+	{
+		return 0;
+	}
+
+	*result = (unsigned int)n;
+	return 1;
+}
+
+
+/*!
+ * GRASS_GC_* 環境変数から GC の設定を読む。コマンドラインの指定が優先する。
+ *
+ *	GRASS_GC_INITIAL_HEAP=BYTES  --gc-initial-heap と同じ。
+ *	GRASS_GC_MAX_HEAP=BYTES      --gc-max-heap と同じ。
+ *	GRASS_GC_THREADS=N           --gc-threads と同じ。
+ *	GRASS_GC_INCREMENTAL=1       --gc-incremental と同じ。 (0 か空なら無効)
+ *
+ * \retval zero     不正な値があった。
+ * \retval non-zero 成功。
+ */
+int
+grass_get_gc_environment(struct grass_gc_options *gc)
+{
+	const char *value;
+	int ok = 1;
+
+	if((value = getenv("GRASS_GC_INITIAL_HEAP")) != NULL)
+	{
+		ok &= grass_parse_size(value, &gc->initial_heap);
+	}
+	if((value = getenv("GRASS_GC_MAX_HEAP")) != NULL)
+	{
+		ok &= grass_parse_size(value, &gc->max_heap);
+	}
+	if((value = getenv("GRASS_GC_THREADS")) != NULL)
+	{
+		ok &= grass_parse_count(value, &gc->threads);
+	}
+	if((value = getenv("GRASS_GC_INCREMENTAL")) != NULL)
+	{
+		gc->incremental = (*value != '\0') && (strcmp(value, "0") != 0);
+	}
+
+	return ok;
+}
+
+
+/*!
+ * Boehm GC を初期化する。 GC_MALLOC などより前に、メインスレッドから一度だけ呼ぶ。
+ *
+ * マークのスレッド数は、 Boehm GC が初期化時に読む GC_MARKERS で渡す。
+ * (並列マークを有効にしてビルドされた Boehm GC でなければ効果は無い)
+ *
+ * \param options 設定。 NULL なら既定値のまま。
+ */
+void
+grass_init_gc(const struct grass_gc_options *options)
+{
+	if((options != NULL) && (options->threads != 0))
+	{
+		char markers[32];
+
+		snprintf(markers, sizeof(markers), "%u", options->threads);
+		setenv("GC_MARKERS", markers, 1);
+	}
+
+	GC_INIT();
+#if defined(HAVE_GC_SET_ON_COLLECTION_EVENT)
+	GC_set_on_collection_event(grass_on_gc_event);
+#else
+	grass_gc_first_no = GC_get_gc_no();
+#endif
+
+	if(options != NULL)
+	{
+		if(options->max_heap != 0)
+		{
+			GC_set_max_heap_size(options->max_heap);
+		}
+		if(options->initial_heap != 0)
+		{
+			size_t heap_size = GC_get_heap_size();
+
+			if(options->initial_heap > heap_size)
+			{
+				GC_expand_hp(options->initial_heap - heap_size);
+			}
+		}
+		if(options->incremental)
+		{
+			GC_enable_incremental();
+		}
+	}
+	grass_gc_totals.peak_heap = GC_get_heap_size();
+}
+
+
+/*!
+ * grass_init_gc() 以降の Boehm GC の統計を \a stats に格納する。
+ */
+void
+grass_get_gc_stats(struct grass_gc_stats *stats)
+{
+	size_t heap_size = GC_get_heap_size();
+
+	assert(stats != NULL);
+
+	*stats = grass_gc_totals;
+#if !defined(HAVE_GC_SET_ON_COLLECTION_EVENT)
+	/* 停止時間は測れないので、回数だけ */
+	stats->collections = GC_get_gc_no() - grass_gc_first_no;
+#endif
+	if(heap_size > stats->peak_heap)
+	{
+		stats->peak_heap = heap_size;
+	}
+}
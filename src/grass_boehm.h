@@ -0,0 +1,66 @@
+/* $Id$ */
+/*! \file
+ * \brief Boehm GC の設定と統計。
+ *
+ * 抽象機械、プログラム、 Dump などは、どのビルドでも Boehm GC のヒープに
+ * 置かれる (GRASS_COMPACT_HEAP でない場合は値と環境も)。
+ * grass_init_gc() は最初の確保より前に呼ぶこと。
+ *
+ * \date 2009-01-06
+ * \author yoh2
+ * $LastChangedBy$
+ * $LastChangedDate$
+ */
+#ifndef grass_boehm_H_
+#define grass_boehm_H_
+
+#include <stddef.h>
+#include "grass_fwd.h"
+
+/*!
+ * Boehm GC の設定。 0 の欄は Boehm GC の既定値 (と、 Boehm GC 自身が読む
+ * 環境変数) に任せる。
+ */
+struct grass_gc_options
+{
+	size_t initial_heap;  /*!< \brief 最初に確保しておくヒープ (バイト) */
+	size_t max_heap;      /*!< \brief ヒープの上限 (バイト) */
+	unsigned int threads; /*!< \brief マークを行うスレッド数 */
+	int incremental;      /*!< \brief インクリメンタル GC を使うか */
+};
+
+/*!
+ * Boehm GC の統計。 grass_init_gc() 以降の分。
+ * GC_set_on_collection_event() の無い Boehm GC (7.6 より前) では
+ * 停止時間は測れず、 0 のままになる。
+ */
+struct grass_gc_stats
+{
+	size_t collections; /*!< \brief GC の回数 */
+	double seconds;     /*!< \brief GC で止まっていた時間の合計 (実時間) */
+	double max_pause;   /*!< \brief GC 1回で止まっていた時間の最大値 (実時間) */
+	double mark_seconds; /*!< \brief そのうちマークにかかった時間の合計 (実時間) */
+	size_t peak_heap;   /*!< \brief ヒープの大きさの最大値 (バイト) */
+};
+
+/* バイト数を解析する。 */
+int
+grass_parse_size(const char *arg, size_t *result);
+
+/* 0 以上の整数を解析する。 */
+int
+grass_parse_count(const char *arg, unsigned int *result);
+
+/* GRASS_GC_* 環境変数から GC の設定を読む。 */
+int
+grass_get_gc_environment(struct grass_gc_options *gc);
+
+/* Boehm GC を初期化する。 */
+void
+grass_init_gc(const struct grass_gc_options *options);
+
+/* Boehm GC の統計を得る。 */
+void
+grass_get_gc_stats(struct grass_gc_stats *stats);
+
+#endif /* grass_boehm_H_ */
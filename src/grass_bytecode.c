@@ -0,0 +1,739 @@
+/* $Id$ */
+/*! \file
+ * \brief 連続した配列に平坦化されたコード (バイトコード) の定義。
+ *
+ * \date 2009-01-06
+ * \author yoh2
+ * $LastChangedBy$
+ * $LastChangedDate$
+ */
+#include "grass_bytecode.h"
+#include "grass_instruction.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <gc.h>
+#include <assert.h>
+
+
+/*!
+ * 命令リストを変換した時の命令数を数える。終端の RETURN は含まない。
+ */
+static size_t
+grass_count_ops(const struct grass_instruction_node *code)
+{
+	size_t count = 0;
+
+	for(; code != NULL; code = code->next)
+	{
+		switch(code->inst.type)
+		{
+		case GRASS_IT_APPLICATION:
+			count++;
+			break;
+
+		case GRASS_IT_ABSTRACTION:
+			/* Abs(n, C') → ABS C' RET */
+			count += 2 + grass_count_ops(code->inst.content.abs.code);
+			break;
+		}
+	}
+
+	return count;
+}
+
+
+/*! grass_compile_program() の変換中の状態。 */
+struct grass_emitter
+{
+	struct grass_opcode *ops;
+
+	/*! 表の伸長に失敗した。 */
+	int failed;
+
+	/*! grass_program::captures になる表。 */
+	size_t *captures;
+	size_t num_captures;
+	size_t captures_capacity;
+
+	/*! 自由変数の解析の作業領域。 grass_index_map はこの中を指す。 */
+	size_t *free_vars;
+	size_t num_free_vars;
+	size_t free_vars_capacity;
+};
+
+/*!
+ * 命令列の中の App の添字を、出力する添字に付け替えるための対応。
+ *
+ * 先頭から offset 番目 (0始まり) の命令を実行する時、環境の上から
+ * locals + offset 個は命令列の中で積まれたもの (引数を含む) で、
+ * それより先はクロージャが捕捉した値である。
+ * flat が非 0 なら、捕捉した値は free_vars[first_free] から num_free 個の
+ * 添字 (Abs の位置の環境での添字、昇順) の値なので、それより先を指す添字は、
+ * 何番目に捕捉した値かに付け替える。
+ * flat が 0 なら付け替えない (トップレベル) 。
+ */
+struct grass_index_map
+{
+	int flat;
+	size_t locals;
+	size_t first_free;
+	size_t num_free;
+};
+
+
+/*!
+ * \a *array の末尾に \a value を追加する。必要なら伸長する。
+ * 失敗したら emitter->failed を立て、以降の追加は何もしない。
+ */
+static void
+grass_emitter_push(struct grass_emitter *emitter, size_t **array,
+                   size_t *size, size_t *capacity, size_t value)
+{
+	if(emitter->failed)
+	{
+		return;
+	}
+	if(*size == *capacity)
+	{
+		size_t new_capacity = (*capacity == 0)? 64: *capacity * 2;
+		size_t *new_array;
+
+		if(*array == NULL)
+		{
+			new_array = (size_t *)GC_MALLOC_ATOMIC(new_capacity * sizeof(new_array[0]));
+		}
+		else
+		{
+			new_array = (size_t *)GC_REALLOC(*array, new_capacity * sizeof(new_array[0]));
+		}
+		if(new_array == NULL)
+		{
+			emitter->failed = 1;
+			return;
+		}
+		*array = new_array;
+		*capacity = new_capacity;
+	}
+	(*array)[(*size)++] = value;
+}
+
+#define GRASS_EMIT_CAPTURE(emitter, value)                                    \
+	grass_emitter_push((emitter), &(emitter)->captures,                   \
+	                   &(emitter)->num_captures, &(emitter)->captures_capacity, (value))
+
+#define GRASS_PUSH_FREE_VAR(emitter, value)                                   \
+	grass_emitter_push((emitter), &(emitter)->free_vars,                  \
+	                   &(emitter)->num_free_vars, &(emitter)->free_vars_capacity, (value))
+
+
+static int
+grass_compare_indices(const void *lhs, const void *rhs)
+{
+	size_t l = *(const size_t *)lhs;
+	size_t r = *(const size_t *)rhs;
+
+	return (l < r)? -1: (l > r)? 1: 0;
+}
+
+
+/*!
+ * 命令列 \a code が、先頭の環境の上から \a locals 個より先を指す添字を集める。
+ *
+ * 集めた添字は、 \a locals 個を除いた環境での添字にして free_vars の末尾に
+ * 追加する。順序は不定で、重複もある。
+ * 入れ子の Abs の本体が参照するものは、その Abs が捕捉するので含める。
+ */
+static void
+grass_collect_free_vars(struct grass_emitter *emitter,
+                        const struct grass_instruction_node *code, size_t locals)
+{
+	size_t bound;
+
+	for(bound = locals; code != NULL; code = code->next, bound++)
+	{
+		size_t first;
+		size_t i;
+
+		switch(code->inst.type)
+		{
+		case GRASS_IT_APPLICATION:
+			if(code->inst.content.app.func_index > bound)
+			{
+				GRASS_PUSH_FREE_VAR(emitter, code->inst.content.app.func_index - bound);
+			}
+			if(code->inst.content.app.arg_index > bound)
+			{
+				GRASS_PUSH_FREE_VAR(emitter, code->inst.content.app.arg_index - bound);
+			}
+			break;
+
+		case GRASS_IT_ABSTRACTION:
+			/* 入れ子の Abs の位置の環境での添字を、この命令列の先頭のものにする */
+			first = emitter->num_free_vars;
+			grass_collect_free_vars(emitter, code->inst.content.abs.code,
+			                        code->inst.content.abs.num_args);
+			if(emitter->failed)
+			{
+				return;
+			}
+			for(i = first; i < emitter->num_free_vars; i++)
+			{
+				if(emitter->free_vars[i] > bound)
+				{
+					emitter->free_vars[first++] = emitter->free_vars[i] - bound;
+				}
+			}
+			emitter->num_free_vars = first;
+			break;
+		}
+	}
+}
+
+
+/*!
+ * 命令列の先頭から \a offset 番目の命令の添字 \a index を、 \a map に従って付け替える。
+ */
+static size_t
+grass_renumber_index(const struct grass_emitter *emitter,
+                     const struct grass_index_map *map, size_t offset, size_t index)
+{
+	const size_t *free_vars;
+	size_t outer;
+	size_t low;
+	size_t high;
+
+	if(!map->flat || (index <= map->locals + offset) || emitter->failed)
+	{
+		return index;
+	}
+
+	outer = index - map->locals - offset;
+	free_vars = &emitter->free_vars[map->first_free];
+	low = 0;
+	high = map->num_free;
+	while(low < high)
+	{
+		size_t middle = low + (high - low) / 2;
+
+		if(free_vars[middle] < outer)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	assert((low < map->num_free) && (free_vars[low] == outer));
+
+	return map->locals + offset + low + 1;
+}
+
+
+static size_t
+grass_emit_app(struct grass_opcode *ops, size_t pc, size_t func_index, size_t arg_index)
+{
+	ops[pc].type = GRASS_OP_APPLICATION;
+	ops[pc].content.app.func_index = func_index;
+	ops[pc].content.app.arg_index = arg_index;
+	ops[pc].content.app.local = 0;
+	ops[pc].content.app.callee = GRASS_CALLEE_UNKNOWN;
+	ops[pc].content.app.callee_code = 0;
+
+	return pc + 1;
+}
+
+
+static size_t
+grass_emit_return(struct grass_opcode *ops, size_t pc)
+{
+	ops[pc].type = GRASS_OP_RETURN;
+
+	return pc + 1;
+}
+
+
+static size_t grass_emit_list(struct grass_emitter *emitter, size_t pc,
+                              const struct grass_instruction_node *code,
+                              const struct grass_index_map *map);
+
+/*!
+ * Abs(num_args, body) を出力する。
+ *
+ * 本体の自由変数を集めて捕捉する値の表を出力し (flat closure) 、
+ * 本体の添字をそれに合わせて付け替える。
+ *
+ * \param map    この Abs を含む命令列の添字の対応。
+ * \param offset この Abs の、命令列の先頭からの位置。
+ *
+ * \return 次の命令の位置。
+ */
+static size_t
+grass_emit_abs(struct grass_emitter *emitter, size_t pc,
+               const struct grass_index_map *map, size_t offset,
+               size_t num_args, const struct grass_instruction_node *body)
+{
+	struct grass_opcode *ops = emitter->ops;
+	struct grass_index_map body_map;
+	const size_t *free_vars;
+	size_t abs_pc = pc++;
+	size_t i;
+
+	assert(num_args > 0);
+
+	ops[abs_pc].type = GRASS_OP_ABSTRACTION;
+	ops[abs_pc].content.abs.num_args = num_args;
+
+	body_map.flat = 1;
+	body_map.locals = num_args;
+	body_map.first_free = emitter->num_free_vars;
+	body_map.num_free = 0;
+
+	grass_collect_free_vars(emitter, body, num_args);
+	if(!emitter->failed)
+	{
+		/* 昇順に並べ、重複を除く */
+		free_vars = &emitter->free_vars[body_map.first_free];
+		qsort(&emitter->free_vars[body_map.first_free],
+		      emitter->num_free_vars - body_map.first_free,
+		      sizeof(emitter->free_vars[0]), grass_compare_indices);
+		for(i = body_map.first_free; i < emitter->num_free_vars; i++)
+		{
+			if((body_map.num_free == 0)
+			   || (free_vars[body_map.num_free - 1] != emitter->free_vars[i]))
+			{
+				emitter->free_vars[body_map.first_free + body_map.num_free++] =
+					emitter->free_vars[i];
+			}
+		}
+		emitter->num_free_vars = body_map.first_free + body_map.num_free;
+	}
+
+	ops[abs_pc].content.abs.captures = emitter->num_captures;
+	GRASS_EMIT_CAPTURE(emitter, body_map.num_free);
+	for(i = 0; i < body_map.num_free; i++)
+	{
+		size_t outer = emitter->free_vars[body_map.first_free + i];
+
+		GRASS_EMIT_CAPTURE(emitter, grass_renumber_index(emitter, map, offset, outer));
+	}
+
+	pc = grass_emit_list(emitter, pc, body, &body_map);
+	pc = grass_emit_return(ops, pc);
+	ops[abs_pc].content.abs.body_length = pc - abs_pc - 1;
+
+	emitter->num_free_vars = body_map.first_free;
+
+	return pc;
+}
+
+
+/*!
+ * 命令リストを出力する。終端の RETURN は出力しない。
+ *
+ * \param map 添字の対応。
+ *
+ * \return 次の命令の位置。
+ */
+static size_t
+grass_emit_list(struct grass_emitter *emitter, size_t pc,
+                const struct grass_instruction_node *code,
+                const struct grass_index_map *map)
+{
+	size_t offset;
+
+	for(offset = 0; code != NULL; code = code->next, offset++)
+	{
+		switch(code->inst.type)
+		{
+		case GRASS_IT_APPLICATION:
+			pc = grass_emit_app(emitter->ops, pc,
+			                    grass_renumber_index(emitter, map, offset,
+			                                         code->inst.content.app.func_index),
+			                    grass_renumber_index(emitter, map, offset,
+			                                         code->inst.content.app.arg_index));
+			break;
+
+		case GRASS_IT_ABSTRACTION:
+			pc = grass_emit_abs(emitter, pc, map, offset,
+			                    code->inst.content.abs.num_args,
+			                    code->inst.content.abs.code);
+			break;
+		}
+	}
+
+	return pc;
+}
+
+
+/*! エスケープ解析の作業領域。どちらも命令数分の要素を持つ。 */
+struct grass_escape_analysis
+{
+	struct grass_program *program;
+	size_t *positions;      /*!< \brief 命令列の各要素の位置 */
+	unsigned char *escapes; /*!< \brief 各要素の結果がエスケープするか */
+};
+
+
+/*!
+ * \a start から始まる命令列の各 App に、結果がエスケープしないか
+ * (app.local) を設定する。入れ子の Abs の本体も解析する。
+ *
+ * 先頭から j 番目の要素の結果は、 j' 番目の要素から添字 j' - j で参照される。
+ * 次のいずれかに当たる結果はエスケープする。
+ * 	- 命令列の最後の要素の結果 (RET で返される)
+ * 	- App の引数として参照される (呼び出し先の環境に入る)
+ * 	- Abs に捕捉される
+ * 	- App の関数として参照され、その App の結果がエスケープする
+ * 	  (部分適用なら、その App が作るクロージャの環境に残る)
+ * 最後の要素の App は常にエスケープするので、末尾呼び出しで呼ばれる
+ * 関数 (呼び出し先の環境が、捨てた呼び出しのものを指す) もここに含まれる。
+ * 後ろの要素から順に決めれば、参照する側は常に先に決まっている。
+ */
+static void
+grass_analyze_escapes(struct grass_escape_analysis *analysis, size_t start)
+{
+	struct grass_opcode *ops = analysis->program->ops;
+	size_t *positions = analysis->positions;
+	unsigned char *escapes = analysis->escapes;
+	size_t length;
+	size_t pc;
+	size_t j;
+
+	/* 作業領域を使う前に、入れ子の本体を解析しておく */
+	length = 0;
+	for(pc = start; ops[pc].type != GRASS_OP_RETURN; length++)
+	{
+		if(ops[pc].type == GRASS_OP_ABSTRACTION)
+		{
+			grass_analyze_escapes(analysis, pc + 1);
+			pc += 1 + ops[pc].content.abs.body_length;
+		}
+		else
+		{
+			pc++;
+		}
+	}
+
+	for(pc = start, j = 0; j < length; j++)
+	{
+		positions[j] = pc;
+		escapes[j] = 0;
+		pc += (ops[pc].type == GRASS_OP_ABSTRACTION)? 1 + ops[pc].content.abs.body_length: 1;
+	}
+
+	for(j = length; j-- > 0; )
+	{
+		struct grass_opcode *op = &ops[positions[j]];
+
+		if(op->type == GRASS_OP_APPLICATION)
+		{
+			op->content.app.local = (j + 1 < length) && !escapes[j];
+			if(!op->content.app.local && (op->content.app.func_index <= j))
+			{
+				escapes[j - op->content.app.func_index] = 1;
+			}
+			if(op->content.app.arg_index <= j)
+			{
+				escapes[j - op->content.app.arg_index] = 1;
+			}
+		}
+		else
+		{
+			const size_t *captures = &analysis->program->captures[op->content.abs.captures];
+			size_t i;
+
+			for(i = 1; i <= captures[0]; i++)
+			{
+				if(captures[i] <= j)
+				{
+					escapes[j - captures[i]] = 1;
+				}
+			}
+		}
+	}
+}
+
+
+/*! 静的に分かっている値。 grass_opcode の app.callee と同じ表現。 */
+struct grass_known_value
+{
+	enum grass_callee_type type;
+	size_t code;
+};
+
+/*!
+ * 初期環境の値を、環境の先頭から並べたもの。
+ * grass_machine.c の create_initial_environment() と合わせること。
+ */
+static const struct grass_known_value grass_initial_known_values[GRASS_INITIAL_ENV_DEPTH] = {
+	{ GRASS_CALLEE_OUT,     0   },
+	{ GRASS_CALLEE_SUCC,    0   },
+	{ GRASS_CALLEE_NUMERIC, 'w' },
+	{ GRASS_CALLEE_IN,      0   }
+};
+
+/*! 関数の解析の作業領域。 */
+struct grass_callee_analysis
+{
+	struct grass_program *program;
+	size_t *positions;                 /*!< \brief 命令列の各要素の位置 (命令数分) */
+	struct grass_known_value *outer;   /*!< \brief 捕捉した値 (捕捉の表の大きさ分) */
+};
+
+
+/*!
+ * 命令列の先頭から \a j 番目の要素の位置の環境で、 \a index 番目の値を求める。
+ *
+ * \param positions 命令列の各要素の位置。
+ * \param num_args  命令列の前に積まれた引数の数。
+ * \param outer     引数より先の値 (捕捉した値か初期環境) 。
+ */
+static struct grass_known_value
+grass_lookup_known_value(const struct grass_program *program, const size_t *positions,
+                         size_t j, size_t index, size_t num_args,
+                         const struct grass_known_value *outer)
+{
+	static const struct grass_known_value unknown = { GRASS_CALLEE_UNKNOWN, 0 };
+	const struct grass_opcode *ops = program->ops;
+	struct grass_known_value value;
+	size_t pc;
+
+	if(index <= j)
+	{
+		/* 命令列の要素の結果。 Abs が作ったクロージャだけが分かる */
+		pc = positions[j - index];
+		if((ops[pc].type != GRASS_OP_ABSTRACTION) || (ops[pc].content.abs.num_args != 1))
+		{
+			return unknown;
+		}
+		value.type = (program->captures[ops[pc].content.abs.captures] == 0)?
+		             GRASS_CALLEE_COMBINATOR: GRASS_CALLEE_CLOSURE;
+		value.code = pc + 1;
+		return value;
+	}
+	if(index - j <= num_args)
+	{
+		return unknown;
+	}
+
+	return outer[index - j - num_args - 1];
+}
+
+
+/*!
+ * \a start から始まる命令列の各 App に、関数が静的に分かれば app.callee を設定する。
+ * 入れ子の Abs の本体も、捕捉する値を引き継いで解析する。
+ *
+ * Abs が作るクロージャは、その Abs の位置の環境から捕捉した値しか
+ * 参照しないので、捕捉した値が分かっていれば本体の中でも分かる。
+ * 引数と App の結果は追わない。
+ *
+ * \param num_args     命令列の前に積まれた引数の数。
+ * \param outer        引数より先の値。
+ * \param first_pos    作業領域 positions のうち、この命令列が使う先頭。
+ * \param first_outer  作業領域 outer のうち、入れ子の本体が使える先頭。
+ */
+static void
+grass_resolve_callees(struct grass_callee_analysis *analysis, size_t start,
+                      size_t num_args, const struct grass_known_value *outer,
+                      size_t first_pos, size_t first_outer)
+{
+	struct grass_opcode *ops = analysis->program->ops;
+	size_t *positions = &analysis->positions[first_pos];
+	size_t length;
+	size_t pc;
+	size_t j;
+
+	for(pc = start, length = 0; ops[pc].type != GRASS_OP_RETURN; length++)
+	{
+		positions[length] = pc;
+		pc += (ops[pc].type == GRASS_OP_ABSTRACTION)? 1 + ops[pc].content.abs.body_length: 1;
+	}
+
+	for(j = 0; j < length; j++)
+	{
+		struct grass_opcode *op = &ops[positions[j]];
+		struct grass_known_value value;
+
+		if(op->type == GRASS_OP_APPLICATION)
+		{
+			value = grass_lookup_known_value(analysis->program, positions, j,
+			                                 op->content.app.func_index, num_args, outer);
+			op->content.app.callee = value.type;
+			op->content.app.callee_code = value.code;
+		}
+		else
+		{
+			const size_t *captures = &analysis->program->captures[op->content.abs.captures];
+			struct grass_known_value *inner = &analysis->outer[first_outer];
+			size_t i;
+
+			for(i = 0; i < captures[0]; i++)
+			{
+				inner[i] = grass_lookup_known_value(analysis->program, positions, j,
+				                                    captures[i + 1], num_args, outer);
+			}
+			grass_resolve_callees(analysis, positions[j] + 1, op->content.abs.num_args,
+			                      inner, first_pos + length, first_outer + captures[0]);
+		}
+	}
+}
+
+
+/*!
+ * grass_instruction_node のリストを、ひとつの連続した配列に変換する。
+ *
+ * 配列の構成は以下の通り。
+ * 	- empty:      RET
+ * 	- main_call:  App(1, 1) RET
+ * 	- true_code:  App(3, 2) RET
+ * 	- entry:      プログラム本体 RET
+ *
+ * false_code は empty と同じ位置を指す。
+ *
+ * 抽象の本体は ABS 命令の直後に置かれ、 RET で終わる。
+ *
+ * Abs は flat closure にする (grass_program 参照) 。
+ * さらにエスケープ解析を行い、結果が呼び出しの外に出ない App に
+ * app.local を立て、関数が静的に分かる App に app.callee を設定する。
+ *
+ * \param code          変換元のコード。 grass_parse() が読み込んだもの、
+ *                      つまりすべての App が環境の範囲内を指すものであること。
+ * \param error_message エラー時にエラーを説明する文字列が格納される。
+ *                      NULL は不可。
+ *
+ * \return 変換結果。失敗時は NULL 。
+ */
+struct grass_program *
+grass_compile_program(const struct grass_instruction_node *code, char **error_message)
+{
+	struct grass_program *program;
+	struct grass_emitter emitter;
+	struct grass_index_map top_level;
+	struct grass_escape_analysis analysis;
+	struct grass_callee_analysis callees;
+	size_t pc;
+
+	assert(error_message != NULL);
+	*error_message = NULL;
+
+	program = (struct grass_program *)GC_MALLOC(sizeof(*program));
+	if(program == NULL)
+	{
+		*error_message = strerror(errno);
+		return NULL;
+	}
+
+	/* empty, main_call, true_code, 本体 + RET */
+	program->num_ops = 1 + 2 + 2 + grass_count_ops(code) + 1;
+	program->ops = (struct grass_opcode *)GC_MALLOC_ATOMIC(
+	                     program->num_ops * sizeof(program->ops[0]));
+	if(program->ops == NULL)
+	{
+		*error_message = strerror(errno);
+		return NULL;
+	}
+
+	memset(&emitter, 0, sizeof(emitter));
+	emitter.ops = program->ops;
+
+	/* トップレベルの環境はクロージャのものではないので、添字は付け替えない */
+	top_level.flat = 0;
+	top_level.locals = 0;
+	top_level.first_free = 0;
+	top_level.num_free = 0;
+
+	pc = 0;
+
+	program->empty = pc;
+	pc = grass_emit_return(program->ops, pc);
+
+	program->main_call = pc;
+	pc = grass_emit_app(program->ops, pc, 1, 1);
+	pc = grass_emit_return(program->ops, pc);
+
+	program->true_code = pc;
+	pc = grass_emit_app(program->ops, pc, 3, 2);
+	pc = grass_emit_return(program->ops, pc);
+
+	program->false_code = program->empty;
+
+	program->entry = pc;
+	pc = grass_emit_list(&emitter, pc, code, &top_level);
+	pc = grass_emit_return(program->ops, pc);
+
+	assert(pc == program->num_ops);
+
+	if(emitter.failed)
+	{
+		*error_message = strerror(errno);
+		return NULL;
+	}
+	program->captures = emitter.captures;
+	program->num_captures = emitter.num_captures;
+
+	analysis.program = program;
+	analysis.positions = (size_t *)GC_MALLOC_ATOMIC(
+	                           program->num_ops * sizeof(analysis.positions[0]));
+	analysis.escapes = (unsigned char *)GC_MALLOC_ATOMIC(program->num_ops);
+	callees.program = program;
+	callees.positions = analysis.positions;
+	callees.outer = (struct grass_known_value *)GC_MALLOC_ATOMIC(
+	                      (program->num_captures + 1) * sizeof(callees.outer[0]));
+	if((analysis.positions == NULL) || (analysis.escapes == NULL)
+	   || (callees.outer == NULL))
+	{
+		*error_message = strerror(errno);
+		return NULL;
+	}
+	grass_analyze_escapes(&analysis, program->entry);
+	grass_resolve_callees(&callees, program->entry, 0, grass_initial_known_values, 0, 0);
+
+	return program;
+}
+
+
+void
+grass_dump_code(const struct grass_program *program, size_t code)
+{
+	const struct grass_opcode *op = &program->ops[code];
+	const size_t *captures;
+	size_t i;
+
+	printf("(");
+	while(op->type != GRASS_OP_RETURN)
+	{
+		switch(op->type)
+		{
+		case GRASS_OP_APPLICATION:
+			printf("App(%zu, %zu)",
+			        op->content.app.func_index,
+			        op->content.app.arg_index);
+			op++;
+			break;
+
+		case GRASS_OP_ABSTRACTION:
+			printf("Abs(%zu, [", op->content.abs.num_args);
+			/* 捕捉する値の添字 */
+			captures = &program->captures[op->content.abs.captures];
+			for(i = 1; i <= captures[0]; i++)
+			{
+				printf((i == 1)? "%zu": " %zu", captures[i]);
+			}
+			printf("] ");
+			grass_dump_code(program, (size_t)(op - program->ops) + 1);
+			printf(")");
+			op += 1 + op->content.abs.body_length;
+			break;
+
+		default:
+			assert(0); /* BUG! */
+			break;
+		}
+		printf(" :: ");
+	}
+	printf("ε)");
+}
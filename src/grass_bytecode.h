@@ -0,0 +1,126 @@
+/* $Id$ */
+/*! \file
+ * \brief 連続した配列に平坦化されたコード (バイトコード) の定義。
+ *
+ * grass_parse_source() が作る grass_instruction_node のリストを、
+ * 固定長の命令の配列に変換したもの。
+ * 抽象機械はこちらを実行する。
+ *
+ * \date 2009-01-06
+ * \author yoh2
+ * $LastChangedBy$
+ * $LastChangedDate$
+ */
+#ifndef grass_bytecode_H_
+#define grass_bytecode_H_
+
+#include <stddef.h>
+#include "grass_fwd.h"
+
+/*! 命令の種類。 */
+enum grass_opcode_type
+{
+	GRASS_OP_APPLICATION, /*!< \brief 関数適用 */
+	GRASS_OP_ABSTRACTION, /*!< \brief ラムダ抽象。本体は直後に続く。 */
+	GRASS_OP_RETURN       /*!< \brief コード列の終端 (ε) */
+};
+
+/*! 静的に分かっている App の関数の種類。 (grass_program 参照) */
+enum grass_callee_type
+{
+	GRASS_CALLEE_UNKNOWN,    /*!< \brief 分からない */
+	GRASS_CALLEE_OUT,        /*!< \brief Outプリミティブ */
+	GRASS_CALLEE_IN,         /*!< \brief Inプリミティブ */
+	GRASS_CALLEE_SUCC,       /*!< \brief Succプリミティブ */
+	GRASS_CALLEE_NUMERIC,    /*!< \brief 数値 callee_code */
+	/*! \brief 本体が callee_code から始まる、引数1個の Abs が作ったクロージャ */
+	GRASS_CALLEE_CLOSURE,
+	/*! \brief GRASS_CALLEE_CLOSURE のうち、何も捕捉しないもの (環境が空) */
+	GRASS_CALLEE_COMBINATOR
+};
+
+/*!
+ * 固定長の命令。
+ */
+struct grass_opcode
+{
+	enum grass_opcode_type type;
+	union
+	{
+		struct
+		{
+			size_t func_index;
+			size_t arg_index;
+			/*!
+			 * 非 0 なら、この App の結果は現在の呼び出しの外に出ない
+			 * (エスケープしない) 。部分適用で作るクロージャは、
+			 * ヒープでなく抽象機械のクロージャスタックに置ける。
+			 */
+			int local;
+			/*! 関数が静的に分かっていれば、その種類。 */
+			enum grass_callee_type callee;
+			/*! callee が数値なら数値、クロージャなら本体の位置。 */
+			size_t callee_code;
+		} app;
+
+		struct
+		{
+			size_t num_args;
+			/*! 本体の命令数 (終端の GRASS_OP_RETURN を含む)。 */
+			size_t body_length;
+			/*! クロージャが捕捉する値の、 grass_program::captures 中の位置。 */
+			size_t captures;
+		} abs;
+	} content;
+};
+
+/*!
+ * コンパイル済みのプログラム。
+ *
+ * コード位置はすべて ops 中のインデックスで表す。
+ * ops はポインタを含まないので GC_MALLOC_ATOMIC で確保される。
+ *
+ * すべての App は実行時の環境の範囲内を指す (grass_parse() が確かめる) ので、
+ * 実行時の環境の参照で範囲を確かめなくてよい。
+ *
+ * Abs が作るクロージャは、本体が参照する値だけを
+ * 捕捉する (flat closure) 。 Abs の captures が指す位置から、
+ * 捕捉する値の個数 c と、それらの Abs の位置の環境での添字 c 個が
+ * captures に並ぶ。クロージャの環境は、この順に値を並べたものになる。
+ * 本体の App の添字は、その環境に合わせて付け替えてある。
+ * また、結果がエスケープしない App には app.local が立っている。
+ *
+ * さらに、関数が静的に分かる App には app.callee が
+ * 設定されている。初期環境のプリミティブと Abs が作ったクロージャを、
+ * 積まれた命令列と、捕捉した Abs の本体の中で追跡したもの (0-CFA の、
+ * 引数と App の結果を追わない簡易版) 。
+ */
+struct grass_program
+{
+	struct grass_opcode *ops;
+	size_t num_ops;
+
+	size_t *captures;    /*!< \brief Abs が捕捉する値の添字の表 */
+	size_t num_captures;
+
+	size_t empty;      /*!< \brief 空のコード (ε) */
+	size_t entry;      /*!< \brief プログラム本体の先頭 */
+	size_t main_call;  /*!< \brief App(1, 1)::ε (初期Dump用) */
+	size_t true_code;  /*!< \brief App(3, 2)::ε (Church true の本体) */
+	size_t false_code; /*!< \brief ε (Church false の本体) */
+};
+
+
+/*!
+ * \brief grass_instruction_node のリストをバイトコードに変換する。
+ */
+struct grass_program *
+grass_compile_program(const struct grass_instruction_node *code, char **error_message);
+
+/*!
+ * \brief \a code の位置から始まるコード列を出力する。
+ */
+void
+grass_dump_code(const struct grass_program *program, size_t code);
+
+#endif /* grass_bytecode_H_ */
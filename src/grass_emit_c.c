@@ -0,0 +1,352 @@
+/* $Id$ */
+/*! \file
+ * \brief Grass プログラムを C のソースに変換する (grass --emit-c)。
+ *
+ * 出力するソースの構成は以下の通り。
+ * 	- grass_compile_program() で変換した命令列と、それを指す grass_program 。
+ * 	- 抽象の本体ごとの C 関数 (grass_native_body) 。 Abs を
+ * 	  GRASS_NATIVE_ABS() に、 App を GRASS_NATIVE_APP() にしたもの。
+ * 	  関数が静的に分かる App は、プリミティブならその場で計算し
+ * 	  (GRASS_NATIVE_PRIMITIVE_APP()) 、クロージャなら本体の関数を直接呼ぶ
+ * 	  (GRASS_NATIVE_CALL()) 。本体の最後の App は末尾呼び出しにする。
+ * 	- 本体の位置から関数を引く表。関数が静的に分からない App が使う。
+ * 	- grass_run_native_program() を呼ぶ main() 。
+ *
+ * 命令列は、 true/false の作成と、再帰が深すぎる呼び出しを実行する
+ * ランタイムの抽象機械が使う。
+ *
+ * \date 2009-01-06
+ * \author yoh2
+ * $LastChangedBy$
+ * $LastChangedDate$
+ */
+
+#include "grass_emit_c.h"
+#include "grass_bytecode.h"
+#include "grass_instruction.h"
+#include <string.h>
+#include <errno.h>
+#include <gc.h>
+#include <assert.h>
+
+
+/*! enum grass_callee_type の各値の名前。 */
+static const char *const grass_callee_names[] = {
+	[GRASS_CALLEE_UNKNOWN]    = "GRASS_CALLEE_UNKNOWN",
+	[GRASS_CALLEE_OUT]        = "GRASS_CALLEE_OUT",
+	[GRASS_CALLEE_IN]         = "GRASS_CALLEE_IN",
+	[GRASS_CALLEE_SUCC]       = "GRASS_CALLEE_SUCC",
+	[GRASS_CALLEE_NUMERIC]    = "GRASS_CALLEE_NUMERIC",
+	[GRASS_CALLEE_CLOSURE]    = "GRASS_CALLEE_CLOSURE",
+	[GRASS_CALLEE_COMBINATOR] = "GRASS_CALLEE_COMBINATOR"
+};
+
+
+static void
+grass_emit_c_ops(FILE *out, const struct grass_program *program)
+{
+	size_t pc;
+
+	fprintf(out, "static const struct grass_opcode grass_ops[%zu] = {\n",
+	        program->num_ops);
+	for(pc = 0; pc < program->num_ops; pc++)
+	{
+		const struct grass_opcode *op = &program->ops[pc];
+
+		switch(op->type)
+		{
+		case GRASS_OP_APPLICATION:
+			fprintf(out, "\t{ GRASS_OP_APPLICATION, { .app = { %zu, %zu, %d, %s, %zu } } },",
+			        op->content.app.func_index, op->content.app.arg_index,
+			        op->content.app.local, grass_callee_names[op->content.app.callee],
+			        op->content.app.callee_code);
+			break;
+
+		case GRASS_OP_ABSTRACTION:
+			fprintf(out, "\t{ GRASS_OP_ABSTRACTION, { .abs = { %zu, %zu, %zu } } },",
+			        op->content.abs.num_args, op->content.abs.body_length,
+			        op->content.abs.captures);
+			break;
+
+		case GRASS_OP_RETURN:
+			fprintf(out, "\t{ GRASS_OP_RETURN, { .app = { 0, 0, 0, GRASS_CALLEE_UNKNOWN, 0 } } },");
+			break;
+
+		default:
+			assert(0); /* BUG! */
+			break;
+		}
+		fprintf(out, " /* %zu */\n", pc);
+	}
+	fprintf(out, "};\n\n");
+
+	/* 空の配列は書けないので、最低 1 要素にする */
+	fprintf(out, "static const size_t grass_captures[%zu] = {",
+	        (program->num_captures > 0)? program->num_captures: 1);
+	for(pc = 0; pc < program->num_captures; pc++)
+	{
+		fprintf(out, (pc % 16 == 0)? "\n\t%zu,": " %zu,", program->captures[pc]);
+	}
+	fprintf(out, (program->num_captures > 0)? "\n};\n\n": " 0 };\n\n");
+
+	fprintf(out,
+		"static const struct grass_program grass_program = {\n"
+		"\t.ops = (struct grass_opcode *)grass_ops,\n"
+		"\t.num_ops = %zu,\n"
+		"\t.captures = (size_t *)grass_captures,\n"
+		"\t.num_captures = %zu,\n"
+		"\t.empty = %zu,\n"
+		"\t.entry = %zu,\n"
+		"\t.main_call = %zu,\n"
+		"\t.true_code = %zu,\n"
+		"\t.false_code = %zu\n"
+		"};\n\n",
+		program->num_ops, program->num_captures, program->empty, program->entry,
+		program->main_call, program->true_code, program->false_code);
+}
+
+
+/*!
+ * App が環境の \a n 番目の値を参照する式を出力する。
+ */
+static void
+grass_emit_c_value(FILE *out, size_t n)
+{
+	fprintf(out, "GRASS_NATIVE_VALUE(env, %zu)", n);
+}
+
+
+/*!
+ * 位置 \a pc の App を出力する。
+ * \a pc の次が RET なら末尾呼び出しにして、本体の関数から return する。
+ *
+ * \retval zero     return していない。
+ * \retval non-zero return した。
+ */
+static int
+grass_emit_c_application(FILE *out, const struct grass_program *program, size_t pc)
+{
+	const struct grass_opcode *op = &program->ops[pc];
+	int tail = (program->ops[pc + 1].type == GRASS_OP_RETURN);
+
+	fprintf(out, "\t/* %zu: App(%zu, %zu) */\n\t", pc,
+	        op->content.app.func_index, op->content.app.arg_index);
+	switch(op->content.app.callee)
+	{
+	case GRASS_CALLEE_OUT:
+	case GRASS_CALLEE_IN:
+	case GRASS_CALLEE_SUCC:
+	case GRASS_CALLEE_NUMERIC:
+		/* 関数が分かっているプリミティブは、環境から取り出さない */
+		fprintf(out, "GRASS_NATIVE_PRIMITIVE_APP(ctx, env, depth, ");
+		switch(op->content.app.callee)
+		{
+		case GRASS_CALLEE_OUT:
+			fprintf(out, "GRASS_OUT_VALUE");
+			break;
+
+		case GRASS_CALLEE_IN:
+			fprintf(out, "GRASS_IN_VALUE");
+			break;
+
+		case GRASS_CALLEE_SUCC:
+			fprintf(out, "GRASS_SUCC_VALUE");
+			break;
+
+		default:
+			fprintf(out, "GRASS_NUMERIC_VALUE(%zu)", op->content.app.callee_code);
+			break;
+		}
+		fprintf(out, ", ");
+		grass_emit_c_value(out, op->content.app.arg_index);
+		fprintf(out, ");\n");
+		return 0;
+
+	case GRASS_CALLEE_CLOSURE:
+	case GRASS_CALLEE_COMBINATOR:
+		/* 本体が分かっているクロージャは、その関数を直接呼ぶ */
+		if(tail)
+		{
+			fprintf(out, "GRASS_NATIVE_TAIL_CALL(ctx, grass_body_%zu, ",
+			        op->content.app.callee_code);
+		}
+		else
+		{
+			fprintf(out, "GRASS_NATIVE_CALL(ctx, env, depth, %zu, grass_body_%zu, ",
+			        op->content.app.callee_code, op->content.app.callee_code);
+		}
+		if(op->content.app.callee == GRASS_CALLEE_CLOSURE)
+		{
+			grass_emit_c_value(out, op->content.app.func_index);
+		}
+		else
+		{
+			fprintf(out, "GRASS_NO_VALUE");
+		}
+		fprintf(out, ", ");
+		grass_emit_c_value(out, op->content.app.arg_index);
+		fprintf(out, ");\n");
+		return tail;
+
+	default:
+		fprintf(out, tail? "GRASS_NATIVE_TAIL_APP(ctx, env, depth, %d, ":
+		                   "GRASS_NATIVE_APP(ctx, env, depth, %d, ",
+		        op->content.app.local);
+		grass_emit_c_value(out, op->content.app.func_index);
+		fprintf(out, ", ");
+		grass_emit_c_value(out, op->content.app.arg_index);
+		fprintf(out, ");\n");
+		return tail;
+	}
+}
+
+
+/*!
+ * \a code から始まる抽象の本体を、 grass_native_body 型の C 関数として出力する。
+ * 本体中の Abs の本体は飛ばす (別の関数として出力する)。
+ */
+static void
+grass_emit_c_body(FILE *out, const struct grass_program *program, size_t code)
+{
+	const struct grass_opcode *ops = program->ops;
+	size_t pc;
+
+	fprintf(out,
+		"static grass_value\n"
+		"grass_body_%zu(struct grass_native_context *ctx, struct grass_value_node *env, size_t depth)\n"
+		"{\n"
+		"\t(void)ctx;\n"
+		"\t(void)depth;\n",
+		code);
+	for(pc = code; ops[pc].type != GRASS_OP_RETURN; )
+	{
+		if(ops[pc].type == GRASS_OP_ABSTRACTION)
+		{
+			fprintf(out, "\t/* %zu: Abs(%zu) */\n\tGRASS_NATIVE_ABS(ctx, env, %zu, %zu, ",
+			        pc, ops[pc].content.abs.num_args, pc, ops[pc].content.abs.num_args);
+			fprintf(out, "%zu);\n", ops[pc].content.abs.captures);
+			pc += 1 + ops[pc].content.abs.body_length;
+			continue;
+		}
+
+		assert(ops[pc].type == GRASS_OP_APPLICATION);
+		if(grass_emit_c_application(out, program, pc))
+		{
+			fprintf(out, "}\n\n");
+			return;
+		}
+		pc++;
+	}
+	fprintf(out,
+		"\treturn env->value;\n"
+		"}\n"
+		"\n");
+}
+
+
+/*!
+ * grass_instruction_node のリストを、単独でコンパイルできる C のソースに変換する。
+ *
+ * \param out           出力先。
+ * \param code          変換元のコード。
+ * \param error_message エラー時にエラーを説明する文字列が格納される。
+ *                      NULL は不可。
+ *
+ * \retval zero     エラー発生。
+ * \retval non-zero 成功。
+ */
+int
+grass_emit_c(FILE *out, const struct grass_instruction_node *code, char **error_message)
+{
+	struct grass_program *program;
+	char *starts;
+	size_t pc;
+
+	assert(out != NULL);
+	assert(error_message != NULL);
+	*error_message = NULL;
+
+	program = grass_compile_program(code, error_message);
+	if(program == NULL)
+	{
+		return 0;
+	}
+
+	/* starts[pc]: pc が本体の先頭なら非 0 */
+	starts = (char *)GC_MALLOC_ATOMIC(program->num_ops);
+	if(starts == NULL)
+	{
+		*error_message = strerror(errno);
+		return 0;
+	}
+	memset(starts, 0, program->num_ops);
+	starts[program->empty] = 1;
+	starts[program->main_call] = 1;
+	starts[program->true_code] = 1;
+	starts[program->false_code] = 1;
+	starts[program->entry] = 1;
+	for(pc = 0; pc < program->num_ops; pc++)
+	{
+		if(program->ops[pc].type == GRASS_OP_ABSTRACTION)
+		{
+			starts[pc + 1] = 1;
+		}
+	}
+
+	fprintf(out, "/* Generated by grass --emit-c. */\n");
+#if defined(GRASS_COMPACT_HEAP)
+	/* ランタイムと同じヒープの表現を使う。 */
+	fprintf(out, "#define GRASS_COMPACT_HEAP 1\n");
+#endif
+#if defined(GRASS_REFCOUNT_HEAP)
+	fprintf(out, "#define GRASS_REFCOUNT_HEAP 1\n");
+#endif
+	fprintf(out,
+		"#include \"grass_runtime.h\"\n"
+		"\n");
+
+	grass_emit_c_ops(out, program);
+
+	for(pc = 0; pc < program->num_ops; pc++)
+	{
+		if(starts[pc])
+		{
+			fprintf(out, "static grass_value grass_body_%zu(struct grass_native_context *, struct grass_value_node *, size_t);\n", pc);
+		}
+	}
+	fprintf(out, "\n");
+	for(pc = 0; pc < program->num_ops; pc++)
+	{
+		if(starts[pc])
+		{
+			grass_emit_c_body(out, program, pc);
+		}
+	}
+
+	fprintf(out, "static const grass_native_body grass_bodies[%zu] = {\n",
+	        program->num_ops);
+	for(pc = 0; pc < program->num_ops; pc++)
+	{
+		if(starts[pc])
+		{
+			fprintf(out, "\t[%zu] = grass_body_%zu,\n", pc, pc);
+		}
+	}
+	fprintf(out,
+		"};\n"
+		"\n"
+		"int\n"
+		"main(void)\n"
+		"{\n"
+		"\treturn grass_run_native_program(&grass_program, grass_bodies);\n"
+		"}\n");
+
+	fflush(out);
+	if(ferror(out))
+	{
+		*error_message = strerror(errno);
+		return 0;
+	}
+
+	return 1;
+}
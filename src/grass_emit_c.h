@@ -0,0 +1,25 @@
+/* $Id$ */
+/*! \file
+ * \brief Grass プログラムを C のソースに変換する (grass --emit-c)。
+ *
+ * 出力は単独でコンパイルできる翻訳単位で、 grass_runtime.h の
+ * ランタイムにリンクして実行する。
+ *
+ * \date 2009-01-06
+ * \author yoh2
+ * $LastChangedBy$
+ * $LastChangedDate$
+ */
+#ifndef grass_emit_c_H_
+#define grass_emit_c_H_
+
+#include <stdio.h>
+#include "grass_fwd.h"
+
+/*!
+ * \brief grass_instruction_node のリストを C のソースに変換して出力する。
+ */
+int
+grass_emit_c(FILE *out, const struct grass_instruction_node *code, char **error_message);
+
+#endif /* grass_emit_c_H_ */
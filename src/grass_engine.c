@@ -0,0 +1,309 @@
+/* $Id$ */
+/*! \file
+ * \brief 実行エンジンの共通インターフェイスと、その登録簿。
+ *
+ * \date 2009-01-06
+ * \author yoh2
+ * $LastChangedBy$
+ * $LastChangedDate$
+ */
+
+#include "grass_engine.h"
+#include "grass_bytecode.h"
+#include "grass_machine.h"
+#include "grass_jit.h"
+#include "grass_eval.h"
+#include "grass_arena.h"
+#include "grass_boehm.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+
+/*!
+ * 初期状態の抽象機械を作る。
+ *
+ * \return 作成した抽象機械。失敗時は NULL 。
+ */
+static struct grass_machine *
+grass_engine_create_machine(const struct grass_program *program,
+                            const struct grass_io *io,
+                            const struct grass_engine_limits *limits,
+                            char **error_message)
+{
+	struct grass_machine *machine;
+
+	machine = grass_create_machine_with_heap_limit(program, limits->max_heap,
+	                                               error_message);
+	if(machine == NULL)
+	{
+		return NULL;
+	}
+	machine->io = io;
+
+	return machine;
+}
+
+
+/*!
+ * 抽象機械のヒープとインラインキャッシュの統計を \a stats に格納する。
+ * ヒープは、 GRASS_COMPACT_HEAP でなければ値も置いている Boehm GC の統計。
+ */
+static void
+grass_engine_machine_stats(const struct grass_machine *machine,
+                           struct grass_engine_stats *stats)
+{
+#if defined(GRASS_COMPACT_HEAP)
+	const struct grass_arena *arena = machine->arena;
+
+	stats->collections = arena->num_minor_collections + arena->num_major_collections;
+	stats->gc_seconds = arena->gc_seconds;
+	stats->gc_max_pause = arena->gc_max_pause;
+	stats->gc_mark_seconds = 0.0;
+	stats->peak_heap = arena->peak_used_blocks * GRASS_ARENA_BLOCK_SIZE;
+	stats->local_closures = 0;
+#else
+	struct grass_gc_stats gc_stats;
+
+	grass_get_gc_stats(&gc_stats);
+	stats->collections = gc_stats.collections;
+	stats->gc_seconds = gc_stats.seconds;
+	stats->gc_max_pause = gc_stats.max_pause;
+	stats->gc_mark_seconds = gc_stats.mark_seconds;
+	stats->peak_heap = gc_stats.peak_heap;
+	stats->local_closures = machine->num_local_closures;
+#endif
+}
+
+
+/*!
+ * 抽象機械を最後まで実行する。
+ * \a limits のステップ数に達しても終わらなければエラーにする。
+ */
+static int
+grass_engine_run_machine(struct grass_machine *machine,
+                         const struct grass_engine_limits *limits,
+                         struct grass_engine_stats *stats,
+                         char **error_message)
+{
+	int result;
+
+	result = grass_run_machine(machine, limits->max_steps, &stats->steps, error_message);
+	grass_engine_machine_stats(machine, stats);
+	if(!result)
+	{
+		return 0;
+	}
+	if(!grass_machine_done(machine))
+	{
+		*error_message = "runtime error: step limit exceeded.";
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/*!
+ * 抽象機械 (grass_run_machine()) で実行する。基準となるエンジン。
+ */
+static int
+grass_machine_engine_run(const struct grass_program *program,
+                         const struct grass_io *io,
+                         const struct grass_engine_limits *limits,
+                         struct grass_engine_stats *stats,
+                         char **error_message)
+{
+	struct grass_machine *machine;
+
+	machine = grass_engine_create_machine(program, io, limits, error_message);
+	if(machine == NULL)
+	{
+		return 0;
+	}
+
+	return grass_engine_run_machine(machine, limits, stats, error_message);
+}
+
+
+/*!
+ * JIT を付けた抽象機械で実行する。
+ * ステップ数の制限がある場合、ネイティブコードは使われない。
+ * この環境で JIT を作れない場合は、 JIT 無しの抽象機械で実行する。
+ */
+static int
+grass_jit_engine_run(const struct grass_program *program,
+                     const struct grass_io *io,
+                     const struct grass_engine_limits *limits,
+                     struct grass_engine_stats *stats,
+                     char **error_message)
+{
+	struct grass_machine *machine;
+	struct grass_jit *jit;
+	char *jit_error_message;
+
+	machine = grass_engine_create_machine(program, io, limits, error_message);
+	if(machine == NULL)
+	{
+		return 0;
+	}
+	jit = grass_create_jit(machine->program, &jit_error_message);
+	if(jit != NULL)
+	{
+		grass_attach_jit(machine, jit);
+	}
+
+	return grass_engine_run_machine(machine, limits, stats, error_message);
+}
+
+
+/*!
+ * 再帰的な評価器 (grass_eval_program()) で実行する。
+ */
+static int
+grass_big_step_engine_run(const struct grass_program *program,
+                          const struct grass_io *io,
+                          const struct grass_engine_limits *limits,
+                          struct grass_engine_stats *stats,
+                          char **error_message)
+{
+	struct grass_machine *machine;
+	int result;
+
+	machine = grass_engine_create_machine(program, io, limits, error_message);
+	if(machine == NULL)
+	{
+		return 0;
+	}
+
+	result = grass_eval_program(machine, limits->max_steps, &stats->steps, error_message);
+	grass_engine_machine_stats(machine, stats);
+
+	return result;
+}
+
+
+static const struct grass_engine grass_machine_engine = {
+	"machine",
+	"the reference abstract machine (default)",
+	grass_machine_engine_run
+};
+
+static const struct grass_engine grass_jit_engine = {
+	"jit",
+	"the machine with hot abstractions compiled to x86-64 code",
+	grass_jit_engine_run
+};
+
+static const struct grass_engine grass_big_step_engine = {
+	"big-step",
+	"a recursive evaluator running calls on the C stack",
+	grass_big_step_engine_run
+};
+
+/*! エンジンの登録簿。先頭が既定のエンジン。 */
+static const struct grass_engine *const grass_engine_registry[] = {
+	&grass_machine_engine,
+	&grass_jit_engine,
+	&grass_big_step_engine,
+	NULL
+};
+
+
+/*!
+ * 登録されているエンジンの一覧を返す。
+ *
+ * \return エンジンへのポインタの配列。 NULL で終わる。
+ */
+const struct grass_engine *const *
+grass_engines(void)
+{
+	return grass_engine_registry;
+}
+
+
+/*!
+ * 名前からエンジンを探す。
+ *
+ * \return 見つかったエンジン。無ければ NULL 。
+ */
+const struct grass_engine *
+grass_find_engine(const char *name)
+{
+	const struct grass_engine *const *engine;
+
+	assert(name != NULL);
+
+	for(engine = grass_engine_registry; *engine != NULL; engine++)
+	{
+		if(strcmp((*engine)->name, name) == 0)
+		{
+			return *engine;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*!
+ * \a engine で \a program を最後まで実行し、統計を取る。
+ *
+ * \param engine        実行するエンジン。
+ * \param program       バイトコードに変換したプログラム。
+ * \param io            Out, In の入出力先。 NULL なら標準入出力。
+ * \param limits        実行の制限。 NULL なら無制限。
+ * \param stats         統計が格納される。 NULL 可。
+ * \param error_message エラー時にエラーを説明する文字列が格納される。 NULL 可。
+ *
+ * \retval zero     エラー発生。
+ * \retval non-zero 正常終了。
+ */
+int
+grass_run_engine(const struct grass_engine *engine,
+                 const struct grass_program *program,
+                 const struct grass_io *io,
+                 const struct grass_engine_limits *limits,
+                 struct grass_engine_stats *stats,
+                 char **error_message)
+{
+	static const struct grass_engine_limits no_limits = { 0, 0 };
+	struct grass_engine_stats dummy_stats;
+	char *dummy_error_message;
+	clock_t start;
+	int result;
+
+	assert(engine != NULL);
+
+	if(io == NULL)
+	{
+		io = &grass_stdio;
+	}
+	if(limits == NULL)
+	{
+		limits = &no_limits;
+	}
+	if(stats == NULL)
+	{
+		stats = &dummy_stats;
+	}
+	if(error_message == NULL)
+	{
+		error_message = &dummy_error_message;
+	}
+	*error_message = NULL;
+	stats->steps = 0;
+	stats->collections = 0;
+	stats->gc_seconds = 0.0;
+	stats->gc_max_pause = 0.0;
+	stats->gc_mark_seconds = 0.0;
+	stats->peak_heap = 0;
+	stats->local_closures = 0;
+
+	start = clock();
+	result = engine->run(program, io, limits, stats, error_message);
+	stats->cpu_seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	return result;
+}
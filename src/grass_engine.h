@@ -0,0 +1,102 @@
+/* $Id$ */
+/*! \file
+ * \brief 実行エンジンの共通インターフェイスと、その登録簿。
+ *
+ * 解析済みのコードを実行する方式 (抽象機械、 JIT 、再帰的な評価器など) を
+ * 同じ形で呼び出せるようにする。エンジンは名前で選ぶ (grass --engine=NAME) 。
+ *
+ * \date 2009-01-06
+ * \author yoh2
+ * $LastChangedBy$
+ * $LastChangedDate$
+ */
+#ifndef grass_engine_H_
+#define grass_engine_H_
+
+#include <stddef.h>
+#include "grass_fwd.h"
+
+/*! 実行の制限。 */
+struct grass_engine_limits
+{
+	size_t max_steps; /*!< \brief 実行する最大ステップ数。 0 なら無制限 */
+
+	/*!
+	 * ヒープの上限 (バイト) 。 0 なら既定値。
+	 * GRASS_COMPACT_HEAP でビルドした場合のみ有効。
+	 */
+	size_t max_heap;
+};
+
+/*! 実行結果の統計。 */
+struct grass_engine_stats
+{
+	size_t steps;       /*!< \brief 実行したステップ数 */
+	double cpu_seconds; /*!< \brief 実行にかかった CPU 時間 (コンパイルを含む) */
+
+	/* 以下は、 GRASS_COMPACT_HEAP ならアリーナの GC (CPU 時間) 、
+	 * そうでなければ Boehm GC (実時間) のもの。 */
+	size_t collections; /*!< \brief GC の回数 */
+	double gc_seconds;  /*!< \brief GC にかかった時間 */
+	double gc_max_pause; /*!< \brief GC 1回にかかった時間の最大値 */
+	/*! \brief そのうちマークにかかった時間。アリーナの GC (コピー) では 0 */
+	double gc_mark_seconds;
+	size_t peak_heap;   /*!< \brief ヒープの使用量の最大値 (バイト) */
+
+	/*!
+	 * エスケープしない部分適用として、ヒープでなくクロージャスタックに
+	 * 置いたクロージャの数。それぞれ、クロージャと引数のセルの2回の
+	 * ヒープ確保を省いている。 GRASS_COMPACT_HEAP では常に 0 。
+	 */
+	size_t local_closures;
+};
+
+/*!
+ * 実行エンジン。
+ */
+struct grass_engine
+{
+	const char *name;        /*!< \brief --engine= に指定する名前 */
+	const char *description; /*!< \brief ヘルプに表示する説明 */
+
+	/*!
+	 * \a program を最後まで実行する。
+	 *
+	 * \param program       バイトコードに変換したプログラム。
+	 * \param io            Out, In の入出力先。
+	 * \param limits        実行の制限。超えた場合はエラーになる。
+	 * \param stats         統計が格納される。エラー時もそこまでの値が入る。
+	 * \param error_message エラー時にエラーを説明する文字列が格納される。
+	 *
+	 * \retval zero     エラー発生。
+	 * \retval non-zero 正常終了。
+	 */
+	int (*run)(const struct grass_program *program,
+	           const struct grass_io *io,
+	           const struct grass_engine_limits *limits,
+	           struct grass_engine_stats *stats,
+	           char **error_message);
+};
+
+
+/*! \brief 既定のエンジン (抽象機械) の名前。 */
+#define GRASS_DEFAULT_ENGINE "machine"
+
+/* 登録されているエンジンの一覧。 NULL で終わる。 */
+const struct grass_engine *const *
+grass_engines(void);
+
+/* 名前からエンジンを探す。 */
+const struct grass_engine *
+grass_find_engine(const char *name);
+
+/* エンジンでプログラムを実行する。 */
+int
+grass_run_engine(const struct grass_engine *engine,
+                 const struct grass_program *program,
+                 const struct grass_io *io,
+                 const struct grass_engine_limits *limits,
+                 struct grass_engine_stats *stats,
+                 char **error_message);
+
+#endif /* grass_engine_H_ */
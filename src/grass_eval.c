@@ -0,0 +1,390 @@
+/* $Id$ */
+/*! \file
+ * \brief 抽象の本体を C のスタック上で再帰的に評価する評価器 (big-step) 。
+ *
+ * 値、環境スタック、プリミティブは抽象機械のものをそのまま使う。
+ * そのため評価器も grass_machine をひとつ持ち、 Dump 以外の状態
+ * (環境スタック、 true/false) はそこに置く。
+ *
+ * \date 2009-01-06
+ * \author yoh2
+ * $LastChangedBy$
+ * $LastChangedDate$
+ */
+
+#include "grass_eval.h"
+#include "grass_machine.h"
+#include "grass_value.h"
+#include "grass_bytecode.h"
+#include "grass_arena.h"
+#include "grass_gc.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+
+/*! 評価中の状態。 */
+struct grass_eval_context
+{
+	struct grass_machine *machine;
+	size_t steps; /*!< \brief 実行したステップ数 (抽象機械の数え方に合わせる) */
+	size_t limit; /*!< \brief 実行する最大ステップ数 */
+	char **error_message;
+};
+
+
+/*!
+ * 関数呼び出しを抽象機械に任せる。
+ * 抽象機械の Dump は空なので、呼び出した本体の RET で止まる。
+ *
+ * \return 呼び出しの結果。エラー時は GRASS_NO_VALUE 。
+ */
+static grass_value
+grass_eval_on_machine(struct grass_eval_context *ctx, size_t code,
+                      struct grass_value_node *env)
+{
+	struct grass_machine *machine = ctx->machine;
+	size_t steps;
+
+	assert(machine->dump_depth == 0);
+	assert(ctx->steps < ctx->limit);
+
+	machine->code = code;
+	machine->env = env;
+	if(!grass_run_machine(machine,
+	                      (ctx->limit == (size_t)-1)? 0: ctx->limit - ctx->steps,
+	                      &steps, ctx->error_message))
+	{
+		return GRASS_NO_VALUE;
+	}
+	ctx->steps += steps;
+	if(!grass_machine_done(machine))
+	{
+		*ctx->error_message = "runtime error: step limit exceeded.";
+		return GRASS_NO_VALUE;
+	}
+
+	return machine->env->value;
+}
+
+
+/*!
+ * ヒープに確保する命令の後で、必要なら GC を行う。
+ *
+ * 呼び出し元の各段のローカル変数が持つ環境は、どれも環境スタック上の
+ * セル (初期環境を含む) なので GC で動かない。セルの中身は GC がルートとして
+ * 書き換える。動く可能性があるのは現在の \a env だけ。
+ *
+ * \retval zero     エラー発生。
+ * \retval non-zero 成功。
+ */
+static int
+grass_eval_safe_point(struct grass_eval_context *ctx, struct grass_value_node **env)
+{
+#if defined(GRASS_COMPACT_HEAP) && !defined(GRASS_REFCOUNT_HEAP)
+	struct grass_machine *machine = ctx->machine;
+
+	machine->env = *env;
+	if(!GRASS_GC_SAFE_POINT(machine, ctx->error_message))
+	{
+		return 0;
+	}
+	*env = machine->env;
+#else
+	(void)ctx;
+	(void)env;
+#endif
+
+	return 1;
+}
+
+
+/*!
+ * \a code から始まるコード列を、環境 \a env で評価する。
+ *
+ * 末尾呼び出しはこの関数の中でループし、それ以外の関数呼び出しは
+ * 再帰呼び出しになる。環境スタックの扱いは grass_run_machine() と同じで、
+ * 呼び出し元の env_base は C のローカル変数に保存する。
+ *
+ * \param depth 再帰の深さ。 GRASS_EVAL_MAX_DEPTH に達したら、
+ *              それより深い呼び出しは抽象機械で実行する。
+ *
+ * \return コード列の評価結果 (RET に達した時の環境の先頭)。
+ *         エラー時は GRASS_NO_VALUE 。
+ */
+static grass_value
+grass_eval_code(struct grass_eval_context *ctx, size_t code,
+                struct grass_value_node *env, size_t depth)
+{
+	struct grass_machine *machine = ctx->machine;
+	const struct grass_opcode *ops = machine->program->ops;
+
+	for(;;)
+	{
+		const struct grass_opcode *op = &ops[code];
+		const size_t *captures;
+		grass_value func;
+		grass_value arg;
+		grass_value closure;
+		grass_value value;
+		size_t callee;
+		struct grass_value_node *callee_env;
+
+		if((op->type != GRASS_OP_RETURN) && (ctx->steps >= ctx->limit))
+		{
+			*ctx->error_message = "runtime error: step limit exceeded.";
+			return GRASS_NO_VALUE;
+		}
+
+		switch(op->type)
+		{
+		case GRASS_OP_RETURN:
+			return env->value;
+
+		case GRASS_OP_ABSTRACTION:
+			captures = &machine->program->captures[op->content.abs.captures];
+			closure = grass_create_flat_closure(code + 1, op->content.abs.num_args,
+			                                    env, captures + 1, captures[0]);
+			if(closure == GRASS_NO_VALUE)
+			{
+				goto memory_error;
+			}
+			env = grass_push_env_cell(machine, closure, env);
+			if(env == NULL)
+			{
+				goto memory_error;
+			}
+			code += 1 + op->content.abs.body_length;
+			ctx->steps++;
+			if(!grass_eval_safe_point(ctx, &env))
+			{
+				return GRASS_NO_VALUE;
+			}
+			break;
+
+		case GRASS_OP_APPLICATION:
+			/* grass_run_machine() 参照。 */
+			arg = grass_get_verified_value_node(env, op->content.app.arg_index)->value;
+			switch(grass_resolve_application(machine, op, env, arg,
+			                                 &func, &value, &callee, &callee_env))
+			{
+			case GRASS_APP_PUSH:
+				env = grass_push_env_cell(machine, value, env);
+				if(env == NULL)
+				{
+					goto memory_error;
+				}
+				code++;
+				ctx->steps++;
+				continue;
+
+			case GRASS_APP_CALL:
+				goto call;
+
+			default:
+				break;
+			}
+
+			if(!GRASS_IS_CLOSURE(func))
+			{
+				machine->env = env;
+				if(!grass_apply_primitive(machine, func, arg, ctx->error_message))
+				{
+					return GRASS_NO_VALUE;
+				}
+				env = machine->env;
+				code++;
+			}
+			else if(GRASS_CLOSURE(func)->num_args > 1)
+			{
+				/* 部分適用。 grass_run_machine() 参照。 */
+#if !defined(GRASS_COMPACT_HEAP)
+				if(op->content.app.local)
+				{
+					closure = grass_create_local_partial_application(machine, func, arg);
+				}
+				else
+#endif
+				{
+					closure = grass_create_partial_application(func, arg);
+				}
+				if(closure == GRASS_NO_VALUE)
+				{
+					goto memory_error;
+				}
+				env = grass_push_env_cell(machine, closure, env);
+				if(env == NULL)
+				{
+					goto memory_error;
+				}
+				code++;
+				if(!grass_eval_safe_point(ctx, &env))
+				{
+					return GRASS_NO_VALUE;
+				}
+			}
+			else
+			{
+				callee = GRASS_CLOSURE(func)->code;
+				callee_env = GRASS_NODE_PTR(GRASS_CLOSURE(func)->env);
+				goto call;
+			}
+			ctx->steps++;
+			break;
+
+		call:
+			if(ops[code + 1].type == GRASS_OP_RETURN)
+			{
+				/* 末尾呼び出しは再帰せず、現在の呼び出しのセルを捨てて続ける。 */
+				GRASS_RC_RETAIN_VALUE(func);
+				GRASS_RC_RETAIN_VALUE(arg);
+				GRASS_DROP_ENV_CELLS(machine);
+				env = grass_push_env_cell(machine, arg, callee_env);
+				code = callee;
+				GRASS_RC_RELEASE_VALUE(arg);
+				GRASS_RC_RELEASE_VALUE(func);
+				if(env == NULL)
+				{
+					goto memory_error;
+				}
+			}
+			else
+			{
+				struct grass_env_mark saved_base = machine->env_base;
+#if !defined(GRASS_COMPACT_HEAP)
+				struct grass_closure_mark saved_closure_base = machine->closure_base;
+#endif
+				grass_value result;
+
+				GRASS_ENTER_CALL(machine);
+				callee_env = grass_push_env_cell(machine, arg, callee_env);
+				if(callee_env == NULL)
+				{
+					goto memory_error;
+				}
+
+				if(depth < GRASS_EVAL_MAX_DEPTH)
+				{
+					result = grass_eval_code(ctx, callee, callee_env, depth + 1);
+				}
+				else
+				{
+					result = grass_eval_on_machine(ctx, callee, callee_env);
+				}
+				if(result == GRASS_NO_VALUE)
+				{
+					return GRASS_NO_VALUE;
+				}
+
+				/* 戻る。 (RET も1ステップと数える) */
+				GRASS_RC_RETAIN_VALUE(result);
+				GRASS_DROP_ENV_CELLS(machine);
+				machine->env_base = saved_base;
+#if !defined(GRASS_COMPACT_HEAP)
+				machine->closure_base = saved_closure_base;
+#endif
+				GRASS_GC_NOTE_RETURN(machine);
+				env = grass_push_env_cell(machine, result, env);
+				GRASS_RC_RELEASE_VALUE(result);
+				if(env == NULL)
+				{
+					goto memory_error;
+				}
+				code++;
+				ctx->steps++;
+			}
+			ctx->steps++;
+			break;
+
+		default:
+			assert(0); /* BUG! */
+			*ctx->error_message = "runtime error: internal error.";
+			return GRASS_NO_VALUE;
+		}
+	}
+
+memory_error:
+	*ctx->error_message = GRASS_HEAP_ERROR_MESSAGE();
+	return GRASS_NO_VALUE;
+}
+
+
+/*!
+ * 作成したばかりの抽象機械 \a machine のプログラムを、最後まで評価する。
+ *
+ * 抽象機械の初期状態
+ * 	(C0, Out::Succ::w::In::ε, (App(1, 1)::ε, ε)::(ε, ε)::ε)
+ * の Dump の代わりに、本体の評価結果 f に対して App(1, 1)::ε を f::ε で
+ * 評価する。
+ *
+ * \param machine       grass_create_machine() で作成した抽象機械。
+ *                      環境スタックと入出力先はこれのものを使う。
+ * \param max_steps     実行する最大ステップ数。 0 なら無制限。
+ *                      超えた場合はエラーになる。
+ * \param num_steps     実行したステップ数が格納される。 NULL 可。
+ * \param error_message エラー時にエラーを説明する文字列が格納される。 NULL 可。
+ *
+ * \retval zero     エラー発生。
+ * \retval non-zero 正常終了。
+ */
+int
+grass_eval_program(struct grass_machine *machine, size_t max_steps,
+                   size_t *num_steps, char **error_message)
+{
+	struct grass_eval_context ctx;
+	char *dummy_error_message;
+	grass_value result;
+	struct grass_value_node *env;
+
+	assert(machine != NULL);
+	assert(machine->code == machine->program->entry);
+
+	if(error_message == NULL)
+	{
+		error_message = &dummy_error_message;
+	}
+	*error_message = NULL;
+
+#if defined(GRASS_COMPACT_HEAP)
+	grass_enter_arena(machine->arena);
+#endif
+
+	ctx.machine = machine;
+	ctx.machine->dump_depth = 0; /* 初期 Dump は使わない */
+	ctx.steps = 0;
+	ctx.limit = (max_steps == 0)? (size_t)-1: max_steps;
+	ctx.error_message = error_message;
+
+	result = grass_eval_code(&ctx, machine->program->entry, machine->env, 0);
+	if(result != GRASS_NO_VALUE)
+	{
+		/* (App(1, 1)::ε, ε) に戻る */
+		GRASS_RC_RETAIN_VALUE(result);
+		GRASS_DROP_ENV_CELLS(ctx.machine);
+		env = grass_push_env_cell(ctx.machine, result, NULL);
+		GRASS_RC_RELEASE_VALUE(result);
+		if(env == NULL)
+		{
+			*error_message = GRASS_HEAP_ERROR_MESSAGE();
+			result = GRASS_NO_VALUE;
+		}
+		else
+		{
+			ctx.steps++;
+			/* 最後の (ε, ε) に戻るのも1ステップと数える */
+			result = grass_eval_code(&ctx, machine->program->main_call, env, 0);
+			if(result != GRASS_NO_VALUE)
+			{
+				ctx.steps++;
+			}
+		}
+	}
+
+	if(num_steps != NULL)
+	{
+		*num_steps = ctx.steps;
+	}
+
+	return result != GRASS_NO_VALUE;
+}
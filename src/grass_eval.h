@@ -0,0 +1,29 @@
+/* $Id$ */
+/*! \file
+ * \brief 抽象の本体を C のスタック上で再帰的に評価する評価器 (big-step) 。
+ *
+ * 抽象機械 (grass_run_machine()) と同じプログラムを、 Dump を使わずに
+ * 実行する。関数呼び出しは評価器自身の再帰呼び出しになり、戻り先は
+ * C のスタックに置かれる。再帰が GRASS_EVAL_MAX_DEPTH を越えると、
+ * それより深い呼び出しは抽象機械 (明示的なスタックである Dump) に任せる。
+ *
+ * \date 2009-01-06
+ * \author yoh2
+ * $LastChangedBy$
+ * $LastChangedDate$
+ */
+#ifndef grass_eval_H_
+#define grass_eval_H_
+
+#include <stddef.h>
+#include "grass_fwd.h"
+
+/*! C のスタック上で再帰する最大の深さ。 */
+#define GRASS_EVAL_MAX_DEPTH 10000
+
+/* 初期状態の抽象機械のプログラムを最後まで評価する。 */
+int
+grass_eval_program(struct grass_machine *machine, size_t max_steps,
+                   size_t *num_steps, char **error_message);
+
+#endif /* grass_eval_H_ */
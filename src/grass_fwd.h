@@ -11,15 +11,41 @@
 #ifndef grass_fwd_H_
 #define grass_fwd_H_
 
+#include <stdint.h>
+
 /* grass_value 関連 */
-struct grass_value;
+
+/*!
+ * 値。1ワードのタグ付き表現 (grass_value.h 参照)。
+ * 数値とプリミティブは即値、クロージャは struct grass_closure へのポインタ。
+ */
+#if defined(GRASS_COMPACT_HEAP)
+typedef uint32_t grass_value;
+#else
+typedef uintptr_t grass_value;
+#endif
+
+struct grass_closure;
 struct grass_value_node;
 
 /* grass_instruction 関連 */
-struct grass_instraction;
-struct grass_instraction_node;
+struct grass_instruction;
+struct grass_instruction_node;
+
+/* grass_bytecode 関連 */
+struct grass_opcode;
+struct grass_program;
 
 /* grass_machine 関連 */
 struct grass_machine;
+struct grass_env_chunk;
+struct grass_closure_chunk;
+struct grass_io;
+
+/* grass_jit 関連 */
+struct grass_jit;
+
+/* grass_engine 関連 */
+struct grass_engine;
 
 #endif /* grass_fwd_H_ */
@@ -0,0 +1,404 @@
+/* $Id$ */
+/*! \file
+ * \brief アリーナ (grass_arena.h) の世代別コピー GC 。
+ *
+ * ヒープ上のオブジェクトは grass_value_node とクロージャの2種類だけで、
+ * どちらも作成後は変更されず、自分より古いオブジェクトしか指さない。
+ * そのため、書き込みバリアも記憶集合も無しに、若い世代だけを集められる。
+ *
+ * 	- 若い世代の GC (minor) では、生き残ったオブジェクトを古い世代の
+ * 	  末尾にコピーする (一度生き残れば古い世代に移す)。
+ * 	- 古い世代が前回の全体の GC 後の倍に育ったら、両方の世代を新しい
+ * 	  古い世代にコピーする (major)。
+ *
+ * コピー先の走査は Cheney の方法で、種類ごとのブロック列を順に辿る。
+ * コピー済みのノードは size を 0 にして left に、クロージャは num_args を 0
+ * にして code にコピー先を入れる。 (環境スタックの移し済みのセルと同じ印)
+ *
+ * ルートは抽象機械の env, Dump の環境, true/false と、環境スタック上の
+ * セル。環境スタックのチャンクは動かないブロックにあるので、セルの中身
+ * だけを書き換える。
+ *
+ * \date 2009-01-06
+ * \author yoh2
+ * $LastChangedBy$
+ * $LastChangedDate$
+ */
+
+#include "grass_gc.h"
+#include "grass_arena.h"
+#include "grass_machine.h"
+#include "grass_value.h"
+#include <time.h>
+#include <assert.h>
+
+#if defined(GRASS_COMPACT_HEAP) && !defined(GRASS_REFCOUNT_HEAP)
+
+/*! コピー先の走査位置 */
+struct grass_gc_scan
+{
+	uint32_t block; /*!< \brief 走査中のブロック。 GRASS_ARENA_NO_BLOCK なら先頭から */
+	size_t ptr;     /*!< \brief 次に走査するオフセット */
+};
+
+/*! GC 中の状態 */
+struct grass_gc
+{
+	struct grass_arena *arena;
+	int failed; /*!< \brief コピー先を確保できなかったか */
+};
+
+
+/*! \brief オフセット \a offset がコピー元にあるか。 */
+#define GRASS_GC_IN_FROM_SPACE(arena, offset) \
+	((arena)->blocks[(offset) >> GRASS_ARENA_BLOCK_SHIFT].space == GRASS_ARENA_FROM)
+
+
+/*!
+ * ノードへの参照 \a ref の指すノードがコピー元にあれば、コピーする。
+ *
+ * \return コピー後のノードへの参照。
+ */
+static grass_node_ref
+grass_gc_evacuate_node(struct grass_gc *gc, grass_node_ref ref)
+{
+	struct grass_arena *arena = gc->arena;
+	struct grass_value_node *node;
+	struct grass_value_node *copy;
+
+	if((ref == GRASS_NO_NODE) || !GRASS_GC_IN_FROM_SPACE(arena, ref))
+	{
+		return ref;
+	}
+
+	node = GRASS_NODE_PTR(ref);
+	if(node->size == 0)
+	{
+		/* コピー済み */
+		return node->left;
+	}
+
+	copy = (struct grass_value_node *)grass_arena_alloc_in(arena, &arena->old,
+	                                                       GRASS_ARENA_NODE);
+	if(copy == NULL)
+	{
+		gc->failed = 1;
+		return ref;
+	}
+	*copy = *node;
+	node->size = 0;
+	node->left = GRASS_NODE_REF(copy);
+
+	return node->left;
+}
+
+
+/*!
+ * 値 \a value がコピー元のクロージャなら、コピーする。
+ *
+ * \return コピー後の値。
+ */
+static grass_value
+grass_gc_evacuate_value(struct grass_gc *gc, grass_value value)
+{
+	struct grass_arena *arena = gc->arena;
+	struct grass_closure *closure;
+	struct grass_closure *copy;
+
+	if(!GRASS_IS_CLOSURE(value) || (value == GRASS_NO_VALUE)
+	|| !GRASS_GC_IN_FROM_SPACE(arena, value))
+	{
+		return value;
+	}
+
+	closure = (struct grass_closure *)GRASS_CLOSURE(value);
+	if(closure->num_args == 0)
+	{
+		/* コピー済み */
+		return (grass_value)closure->code;
+	}
+
+	copy = (struct grass_closure *)grass_arena_alloc_in(arena, &arena->old,
+	                                                    GRASS_ARENA_CLOSURE);
+	if(copy == NULL)
+	{
+		gc->failed = 1;
+		return value;
+	}
+	*copy = *closure;
+	closure->num_args = 0;
+	closure->code = GRASS_CLOSURE_VALUE(copy);
+
+	return (grass_value)closure->code;
+}
+
+
+/*!
+ * ノードの指すものをコピーし、参照を書き換える。
+ */
+static void
+grass_gc_scan_node(struct grass_gc *gc, struct grass_value_node *node)
+{
+	node->value = grass_gc_evacuate_value(gc, node->value);
+	node->left = grass_gc_evacuate_node(gc, node->left);
+	node->right = grass_gc_evacuate_node(gc, node->right);
+	node->rest = grass_gc_evacuate_node(gc, node->rest);
+}
+
+
+/*!
+ * ルート (抽象機械の状態と環境スタック) の指すものをコピーする。
+ *
+ * \param major 非ゼロなら全体の GC 。そうでなければ、前回の GC から
+ *              書き換えられていない環境スタックと Dump の底の部分は走査しない。
+ */
+static void
+grass_gc_scan_roots(struct grass_gc *gc, struct grass_machine *machine, int major)
+{
+	struct grass_env_chunk *chunk;
+	size_t env_floor = major? 0: machine->gc_env_floor;
+	size_t i;
+
+	machine->env = GRASS_NODE_PTR(grass_gc_evacuate_node(gc, GRASS_NODE_REF(machine->env)));
+	machine->true_value = grass_gc_evacuate_value(gc, machine->true_value);
+	machine->false_value = grass_gc_evacuate_value(gc, machine->false_value);
+
+	for(i = major? 0: machine->gc_dump_floor; i < machine->dump_depth; i++)
+	{
+		machine->dump[i].env = GRASS_NODE_PTR(
+			grass_gc_evacuate_node(gc, GRASS_NODE_REF(machine->dump[i].env)));
+	}
+
+	/* 環境スタックの env_floor から env_top まで */
+	chunk = machine->env_top.chunk;
+	while(chunk->index > env_floor / GRASS_ENV_CHUNK_CELLS)
+	{
+		chunk = chunk->prev;
+	}
+	i = env_floor - chunk->index * GRASS_ENV_CHUNK_CELLS;
+	for(;;)
+	{
+		size_t used = (chunk == machine->env_top.chunk)?
+		                  machine->env_top.used: GRASS_ENV_CHUNK_CELLS;
+
+		for(; i < used; i++)
+		{
+			grass_gc_scan_node(gc, &chunk->cells[i]);
+		}
+		if(chunk == machine->env_top.chunk)
+		{
+			break;
+		}
+		chunk = chunk->next;
+		i = 0;
+	}
+
+	machine->gc_env_floor = GRASS_ENV_MARK_DEPTH(machine->env_base);
+	machine->gc_dump_floor = machine->dump_depth;
+}
+
+
+/*!
+ * コピー先 (古い世代) の \a kind のオブジェクトを \a scan の位置から
+ * 末尾まで走査する。
+ *
+ * \return 1つでも走査したら非ゼロ。
+ */
+static int
+grass_gc_scan_copies(struct grass_gc *gc, struct grass_gc_scan *scan,
+                     enum grass_arena_kind kind)
+{
+	struct grass_arena *arena = gc->arena;
+	const struct grass_arena_bump *bump = &arena->old.bumps[kind];
+	int scanned = 0;
+
+	if(scan->block == GRASS_ARENA_NO_BLOCK)
+	{
+		if(bump->first == GRASS_ARENA_NO_BLOCK)
+		{
+			return 0;
+		}
+		scan->block = bump->first;
+		scan->ptr = (size_t)scan->block << GRASS_ARENA_BLOCK_SHIFT;
+	}
+
+	for(;;)
+	{
+		/* 走査中にもコピーされて末尾は伸びるので、毎回求め直す */
+		size_t end = (scan->block == bump->last)? bump->ptr:
+		             ((size_t)scan->block << GRASS_ARENA_BLOCK_SHIFT)
+		             + arena->blocks[scan->block].used;
+
+		if(scan->ptr < end)
+		{
+			if(kind == GRASS_ARENA_NODE)
+			{
+				grass_gc_scan_node(gc, (struct grass_value_node *)(arena->base + scan->ptr));
+				scan->ptr += GRASS_ARENA_NODE_SIZE;
+			}
+			else
+			{
+				struct grass_closure *closure
+					= (struct grass_closure *)(arena->base + scan->ptr);
+
+				closure->env = grass_gc_evacuate_node(gc, closure->env);
+				scan->ptr += GRASS_ARENA_CLOSURE_SIZE;
+			}
+			scanned = 1;
+		}
+		else if(scan->block == bump->last)
+		{
+			return scanned;
+		}
+		else
+		{
+			scan->block = arena->blocks[scan->block].next;
+			scan->ptr = (size_t)scan->block << GRASS_ARENA_BLOCK_SHIFT;
+		}
+	}
+}
+
+
+/*!
+ * 空間 \a space のブロックをコピー元にする。
+ */
+static void
+grass_gc_flip_space(struct grass_arena *arena, const struct grass_arena_space *space)
+{
+	int kind;
+
+	for(kind = 0; kind < GRASS_ARENA_NUM_KINDS; kind++)
+	{
+		uint32_t block;
+
+		for(block = space->bumps[kind].first; block != GRASS_ARENA_NO_BLOCK;
+		    block = arena->blocks[block].next)
+		{
+			arena->blocks[block].space = GRASS_ARENA_FROM;
+		}
+	}
+}
+
+
+/*!
+ * 若い世代 (\a major が非 0 なら全体) を集める。
+ *
+ * \retval zero     コピー先のブロックが足りなかった。
+ * \retval non-zero 成功。
+ */
+static int
+grass_gc_collect(struct grass_machine *machine, int major)
+{
+	struct grass_arena *arena = machine->arena;
+	struct grass_arena_space from_young = arena->young;
+	struct grass_arena_space from_old;
+	struct grass_gc_scan scans[GRASS_ARENA_NUM_KINDS];
+	struct grass_gc gc;
+	clock_t start = clock();
+	double seconds;
+	int kind;
+	int scanned;
+
+	grass_gc_flip_space(arena, &arena->young);
+	grass_arena_init_space(&arena->young);
+	if(major)
+	{
+		from_old = arena->old;
+		grass_gc_flip_space(arena, &arena->old);
+		grass_arena_init_space(&arena->old);
+	}
+	for(kind = 0; kind < GRASS_ARENA_NUM_KINDS; kind++)
+	{
+		scans[kind].block = arena->old.bumps[kind].last;
+		scans[kind].ptr = arena->old.bumps[kind].ptr;
+	}
+
+	gc.arena = arena;
+	gc.failed = 0;
+	arena->collecting = 1;
+
+	grass_gc_scan_roots(&gc, machine, major);
+	do
+	{
+		scanned = 0;
+		for(kind = 0; kind < GRASS_ARENA_NUM_KINDS; kind++)
+		{
+			scanned |= grass_gc_scan_copies(&gc, &scans[kind], (enum grass_arena_kind)kind);
+		}
+	}while(scanned && !gc.failed);
+
+	arena->collecting = 0;
+	grass_arena_release_space(arena, &from_young, 0);
+	if(major)
+	{
+		grass_arena_release_space(arena, &from_old, 1);
+		arena->major_threshold = arena->old.num_blocks * 2;
+		if(arena->major_threshold < GRASS_ARENA_MIN_MAJOR_BLOCKS)
+		{
+			arena->major_threshold = GRASS_ARENA_MIN_MAJOR_BLOCKS;
+		}
+		arena->num_major_collections++;
+	}
+	else
+	{
+		arena->num_minor_collections++;
+	}
+
+	seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+	arena->gc_seconds += seconds;
+	if(seconds > arena->gc_max_pause)
+	{
+		arena->gc_max_pause = seconds;
+	}
+
+	return !gc.failed;
+}
+
+
+/*!
+ * 抽象機械 \a machine のアリーナの GC を行う。
+ * 古い世代が大きくなっていれば全体を、そうでなければ若い世代だけを集める。
+ *
+ * GC の後には、若い世代 1 つ分 (young_limit ブロック) の空きが上限までに
+ * 残っていなければならない。全体を集めても残らなければ、若い世代を
+ * 小さくして GC を繰り返すことはせず、すぐにエラーにする。
+ * (上限の近くで GC が頻発し、実行時間が生きているデータの量の 2 乗に
+ * なるのを避ける)
+ *
+ * ヒープ上のオブジェクトを指すものは machine の中にしか無いこと。
+ * ローカル変数に持っていた env などは、 GC 後に machine から読み直すこと。
+ *
+ * \retval zero     生きているオブジェクトが上限に近づきすぎた。
+ *                  \a error_message にエラーの説明が格納される。
+ * \retval non-zero 成功。
+ */
+int
+grass_collect_garbage(struct grass_machine *machine, char **error_message)
+{
+	struct grass_arena *arena = machine->arena;
+	int major;
+	int ok;
+
+	assert(!arena->collecting);
+
+	/* 若い世代が全部生き残ると空きが足りなくなる場合も、全体を集める */
+	major = (arena->old.num_blocks >= arena->major_threshold)
+	     || (arena->old.num_blocks + arena->young_limit * 2 > arena->max_used_blocks);
+	ok = grass_gc_collect(machine, major);
+	if(ok && !major
+	&& (arena->num_used_blocks + arena->young_limit > arena->max_used_blocks))
+	{
+		ok = grass_gc_collect(machine, 1);
+	}
+
+	if(!ok || (arena->num_used_blocks + arena->young_limit > arena->max_used_blocks))
+	{
+		arena->exhausted = 1;
+		*error_message = grass_arena_error_message(arena);
+		return 0;
+	}
+
+	return 1;
+}
+
+#endif /* defined(GRASS_COMPACT_HEAP) && !defined(GRASS_REFCOUNT_HEAP) */
@@ -0,0 +1,63 @@
+/* $Id$ */
+/*! \file
+ * \brief アリーナ (grass_arena.h) の世代別コピー GC 。
+ *
+ * GRASS_COMPACT_HEAP でビルドした場合のみ使われる。 GRASS_REFCOUNT_HEAP の場合は
+ * 参照カウントで解放するので使われない。
+ * 抽象機械は、ヒープ上のオブジェクトを指すものが machine (env, Dump,
+ * 環境スタック, true/false) にしか無い位置でだけ GC を行う。
+ *
+ * \date 2009-01-06
+ * \author yoh2
+ * $LastChangedBy$
+ * $LastChangedDate$
+ */
+#ifndef grass_gc_H_
+#define grass_gc_H_
+
+#include "grass_fwd.h"
+#include "grass_arena.h"
+
+#if defined(GRASS_COMPACT_HEAP) && !defined(GRASS_REFCOUNT_HEAP)
+
+/*!
+ * \brief 関数から戻って env_base が下がった時に呼ぶ。
+ *
+ * 環境スタックの env_top は env_base までしか下がらないので、前回の GC 以降の
+ * env_base の最小値より下のセルは書き換えられておらず、古い世代しか指さない。
+ * Dump も同様。
+ */
+#define GRASS_GC_NOTE_RETURN(machine)                                              \
+	do                                                                         \
+	{                                                                          \
+		size_t depth_ = GRASS_ENV_MARK_DEPTH((machine)->env_base);         \
+		if(depth_ < (machine)->gc_env_floor)                               \
+		{                                                                  \
+			(machine)->gc_env_floor = depth_;                          \
+		}                                                                  \
+		if((machine)->dump_depth < (machine)->gc_dump_floor)               \
+		{                                                                  \
+			(machine)->gc_dump_floor = (machine)->dump_depth;          \
+		}                                                                  \
+	}while(0)
+
+/* machine のアリーナの GC を行う。 */
+int
+grass_collect_garbage(struct grass_machine *machine, char **error_message);
+
+/*!
+ * \brief 必要なら GC を行う。
+ * machine->env 以外にヒープ上のオブジェクトを指すローカル変数が無い位置で使う。
+ * 失敗時は 0 。
+ */
+#define GRASS_GC_SAFE_POINT(machine, error_message)                    \
+	(!GRASS_ARENA_SHOULD_COLLECT((machine)->arena)                 \
+	 || grass_collect_garbage((machine), (error_message)))
+
+#else /* defined(GRASS_COMPACT_HEAP) && !defined(GRASS_REFCOUNT_HEAP) */
+
+#define GRASS_GC_NOTE_RETURN(machine) ((void)0)
+
+#endif /* defined(GRASS_COMPACT_HEAP) && !defined(GRASS_REFCOUNT_HEAP) */
+
+#endif /* grass_gc_H_ */
@@ -9,13 +9,81 @@
  */
 #include "grass_instruction.h"
 #include <stdio.h>
-#include <gc.h>
+#include <stdlib.h>
 #include <assert.h>
 
 
+/*! コード領域のチャンクあたりのノード数 */
+#define GRASS_CODE_CHUNK_NODES 4096
+
+/*! コード領域のチャンク。 */
+struct grass_code_chunk
+{
+	struct grass_code_chunk *prev; /*!< \brief ひとつ前に確保したチャンク */
+	struct grass_instruction_node nodes[GRASS_CODE_CHUNK_NODES];
+};
+
+/*!
+ * コード領域。
+ *
+ * 命令ノードは Boehm GC のヒープではなく malloc したチャンクに詰めて置く。
+ * GC はこの領域を走査しないので、大きなプログラムでも GC ごとにコード全体を
+ * 辿り直す手間がかからない。ノードが指すのは同じ領域のノードだけなので、
+ * この領域をルートとして登録する必要もない。
+ * ノードはバイトコードに変換すれば要らなくなるので、
+ * grass_free_instruction_nodes() でまとめて解放する。
+ */
+static struct grass_code_chunk *grass_code_chunk = NULL;
+static size_t grass_code_used = GRASS_CODE_CHUNK_NODES; /*!< \brief 現在のチャンクの使用済みノード数 */
+
+
+/*!
+ * コード領域から命令ノードをひとつ確保する。
+ *
+ * \return 確保したノード。失敗時は NULL 。
+ */
+static struct grass_instruction_node *
+grass_alloc_instruction_node(void)
+{
+	if(grass_code_used == GRASS_CODE_CHUNK_NODES)
+	{
+		struct grass_code_chunk *chunk;
+
+		chunk = (struct grass_code_chunk *)malloc(sizeof(*chunk));
+		if(chunk == NULL)
+		{
+			return NULL;
+		}
+		chunk->prev = grass_code_chunk;
+		grass_code_chunk = chunk;
+		grass_code_used = 0;
+	}
+
+	return &grass_code_chunk->nodes[grass_code_used++];
+}
+
+
+/*!
+ * これまでに作成した命令ノードを、すべて解放する。
+ * 解放したノードを指すリストは、以後使ってはならない。
+ */
+void
+grass_free_instruction_nodes(void)
+{
+	while(grass_code_chunk != NULL)
+	{
+		struct grass_code_chunk *prev = grass_code_chunk->prev;
+
+		free(grass_code_chunk);
+		grass_code_chunk = prev;
+	}
+	grass_code_used = GRASS_CODE_CHUNK_NODES;
+}
+
+
 /*! 
  * 関数適用のノードを作成する。
- * ノードはBoehm GCによって作成されるので、明示的な開放の必要なし。
+ * ノードはコード領域に作成され、 grass_free_instruction_nodes() で解放される。
  *
  * \param func_index 関数のインデックス。
  * \param arg_index 引数のインデックス。
@@ -26,7 +94,7 @@ struct grass_instruction_node *
 grass_create_application_node(size_t func_index, size_t arg_index)
 {
 	struct grass_instruction_node *new_node
-		= (struct grass_instruction_node *)GC_MALLOC(sizeof(new_node[0]));
+		= grass_alloc_instruction_node();
 	if(new_node == NULL)
 	{
 		return NULL;
@@ -43,7 +111,7 @@ grass_create_application_node(size_t func_index, size_t arg_index)
 
 /*! 
  * 関数定義のノードを作成する。
- * ノードはBoehm GCによって作成されるので、明示的な開放の必要なし。
+ * ノードはコード領域に作成され、 grass_free_instruction_nodes() で解放される。
  *
  * \param func_index 関数のインデックス。
  * \param arg_index 引数のインデックス。
@@ -54,7 +122,7 @@ struct grass_instruction_node *
 grass_create_abstraction_node(size_t num_args, struct grass_instruction_node *code)
 {
 	struct grass_instruction_node *new_node
-		= (struct grass_instruction_node *)GC_MALLOC(sizeof(new_node[0]));
+		= grass_alloc_instruction_node();
 	if(new_node == NULL)
 	{
 		return NULL;
@@ -13,6 +13,9 @@
 #include <stddef.h>
 #include "grass_fwd.h"
 
+/*! 初期環境 (Out :: Succ :: w :: In :: ε) の要素数。 */
+#define GRASS_INITIAL_ENV_DEPTH 4
+
 struct grass_application
 {
 	size_t func_index;
@@ -61,6 +64,10 @@ grass_create_abstraction_node(size_t num_args, struct grass_instruction_node *co
 struct grass_instruction_node *
 grass_append_instruction_list(struct grass_instruction_node *list1, struct grass_instruction_node *list2);
 
+/*! \brief 作成した命令ノードをすべて解放する。 */
+void
+grass_free_instruction_nodes(void);
+
 void
 grass_dump_instruction_list(const struct grass_instruction_node *inst_list);
 
@@ -0,0 +1,564 @@
+/* $Id$ */
+/*! \file
+ * \brief 抽象の本体をネイティブコード (x86-64) に変換する JIT 。
+ *
+ * \date 2009-01-06
+ * \author yoh2
+ * $LastChangedBy$
+ * $LastChangedDate$
+ */
+
+#include "grass_jit.h"
+#include "grass_machine.h"
+#include "grass_value.h"
+#include "grass_bytecode.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <gc.h>
+#include <assert.h>
+
+#if defined(__x86_64__) && defined(__linux__) && defined(__GNUC__)
+#define GRASS_JIT_SUPPORTED 1
+#include <stdint.h>
+#include <sys/mman.h>
+#endif
+
+
+#if defined(GRASS_JIT_SUPPORTED)
+
+/*! 変換結果を書き込む領域の最小サイズ。 */
+#define GRASS_JIT_AREA_SIZE (1024 * 1024)
+
+/*! App 1個あたりのネイティブコードの最大長 (処理本体と出口)。 */
+#define GRASS_JIT_MAX_APP_LENGTH 192
+
+/*! プロローグ、エピローグ、終端の最大長。 */
+#define GRASS_JIT_MAX_FRAME_LENGTH 64
+
+/*!
+ * grass_value を r13, r14 との間で読み書きする命令の REX プレフィクス。
+ * GRASS_COMPACT_HEAP の場合、値は32ビット。
+ */
+#if defined(GRASS_COMPACT_HEAP)
+#define GRASS_JIT_REX_VALUE 0x44 /* REX.R */
+#else
+#define GRASS_JIT_REX_VALUE 0x4c /* REX.W REX.R */
+#endif
+
+/*!
+ * 生成したコードの入口。
+ *
+ * \param machine  実行する抽象機械。環境は machine->env に置く。
+ * \param fragment 実行を開始する App の処理の先頭。
+ *
+ * \return 抽象機械が実行を再開する位置。エラー時は GRASS_NATIVE_ERROR 。
+ */
+typedef size_t (*grass_jit_code)(struct grass_machine *machine,
+                                 const unsigned char *fragment);
+
+/*! ネイティブコードの書き込み先。 */
+struct grass_jit_buffer
+{
+	unsigned char *start;
+	unsigned char *p;
+};
+
+/*! 後で飛び先を埋める rel32 の位置。 */
+struct grass_jit_fixups
+{
+	size_t call_exit;      /*!< \brief クロージャの適用の出口 */
+	size_t error;          /*!< \brief エラーの出口 */
+};
+
+
+static void
+grass_jit_emit(struct grass_jit_buffer *buf, const unsigned char *bytes, size_t length)
+{
+	memcpy(buf->p, bytes, length);
+	buf->p += length;
+}
+
+#define GRASS_JIT_EMIT(buf, ...)                                   \
+	do                                                         \
+	{                                                          \
+		static const unsigned char bytes_[] = { __VA_ARGS__ }; \
+		grass_jit_emit((buf), bytes_, sizeof(bytes_));     \
+	}while(0)
+
+static void
+grass_jit_emit_u8(struct grass_jit_buffer *buf, unsigned int n)
+{
+	*buf->p++ = (unsigned char)n;
+}
+
+static void
+grass_jit_emit_u32(struct grass_jit_buffer *buf, uint32_t n)
+{
+	memcpy(buf->p, &n, sizeof(n));
+	buf->p += sizeof(n);
+}
+
+static void
+grass_jit_emit_u64(struct grass_jit_buffer *buf, uint64_t n)
+{
+	memcpy(buf->p, &n, sizeof(n));
+	buf->p += sizeof(n);
+}
+
+/*!
+ * 飛び先未定の jcc rel32 (0F cc) を出力する。
+ *
+ * \return rel32 の位置 (start からのオフセット)。
+ */
+static size_t
+grass_jit_emit_jcc(struct grass_jit_buffer *buf, unsigned int cc)
+{
+	size_t field;
+
+	grass_jit_emit_u8(buf, 0x0f);
+	grass_jit_emit_u8(buf, cc);
+	field = (size_t)(buf->p - buf->start);
+	grass_jit_emit_u32(buf, 0);
+
+	return field;
+}
+
+/*! jmp rel32 を出力する。 */
+static void
+grass_jit_emit_jmp(struct grass_jit_buffer *buf, const unsigned char *target)
+{
+	grass_jit_emit_u8(buf, 0xe9);
+	grass_jit_emit_u32(buf, (uint32_t)(int32_t)(target - (buf->p + 4)));
+}
+
+/*! rel32 の飛び先を埋める。 */
+static void
+grass_jit_patch(struct grass_jit_buffer *buf, size_t field, const unsigned char *target)
+{
+	int32_t rel = (int32_t)(target - (buf->start + field + 4));
+
+	memcpy(buf->start + field, &rel, sizeof(rel));
+}
+
+/*! mov rax, imm64; call rax */
+static void
+grass_jit_emit_call(struct grass_jit_buffer *buf, const void *func)
+{
+	GRASS_JIT_EMIT(buf, 0x48, 0xb8);
+	grass_jit_emit_u64(buf, (uint64_t)(uintptr_t)func);
+	GRASS_JIT_EMIT(buf, 0xff, 0xd0);
+}
+
+
+/*!
+ * ネイティブコードから呼ばれる、プリミティブの適用。
+ *
+ * \retval zero     エラー発生。 machine->native_error_message に説明が入る。
+ * \retval non-zero 成功。
+ */
+static int
+grass_jit_apply_primitive(struct grass_machine *machine, size_t code,
+                          grass_value func,
+                          grass_value arg)
+{
+	machine->code = code;
+	return grass_apply_primitive(machine, func, arg, &machine->native_error_message);
+}
+
+
+/*!
+ * 環境の index 番目の値を取り出し、 r13 (func) か r14 (arg) に入れるコードを出力する。
+ *
+ * 環境は machine->env にあり、 r12 がそのアドレスを指す。
+ * 1番目と2番目は、 grass_value_node のフィールドを直接読む。
+ * (Abs の中では環境が空になることはないので、先頭のノードは必ずある)
+ * それより先は grass_get_verified_value_node() を呼ぶ。
+ * GRASS_COMPACT_HEAP の場合、ノード間の参照はオフセットなので、
+ * 2番目も grass_get_verified_value_node() を呼ぶ。
+ * 添字が範囲内であることは読み込み時に確かめてあるので、範囲の確認は出力しない。
+ */
+static void
+grass_jit_emit_lookup(struct grass_jit_buffer *buf, size_t index, int to_arg)
+{
+	if(index == 1)
+	{
+		/* mov rax, [r12] */
+		GRASS_JIT_EMIT(buf, 0x49, 0x8b, 0x04, 0x24);
+	}
+#if !defined(GRASS_COMPACT_HEAP)
+	else if(index == 2)
+	{
+		/* mov rax, [r12]
+		 * cmp qword [rax + size], 1
+		 * jne tree
+		 * mov rax, [rax + rest]
+		 * jmp done
+		 * tree:
+		 * mov rax, [rax + left]
+		 * done:
+		 */
+		GRASS_JIT_EMIT(buf, 0x49, 0x8b, 0x04, 0x24);
+		GRASS_JIT_EMIT(buf, 0x48, 0x83, 0x78);
+		grass_jit_emit_u8(buf, offsetof(struct grass_value_node, size));
+		GRASS_JIT_EMIT(buf, 0x01, 0x75, 0x06, 0x48, 0x8b, 0x40);
+		grass_jit_emit_u8(buf, offsetof(struct grass_value_node, rest));
+		GRASS_JIT_EMIT(buf, 0xeb, 0x04, 0x48, 0x8b, 0x40);
+		grass_jit_emit_u8(buf, offsetof(struct grass_value_node, left));
+	}
+#endif
+	else
+	{
+		/* mov rdi, [r12]
+		 * mov rsi, index
+		 * call grass_get_verified_value_node
+		 */
+		GRASS_JIT_EMIT(buf, 0x49, 0x8b, 0x3c, 0x24, 0x48, 0xbe);
+		grass_jit_emit_u64(buf, index);
+		grass_jit_emit_call(buf, (const void *)grass_get_verified_value_node);
+	}
+
+	/* mov r13, [rax] / mov r14, [rax] (value は先頭のフィールド) */
+	if(to_arg)
+	{
+		GRASS_JIT_EMIT(buf, GRASS_JIT_REX_VALUE, 0x8b, 0x30);
+	}
+	else
+	{
+		GRASS_JIT_EMIT(buf, GRASS_JIT_REX_VALUE, 0x8b, 0x28);
+	}
+}
+
+
+/*!
+ * App(m, n) ひとつ分の処理を出力する。
+ *
+ * 関数がクロージャなら出口に飛び、抽象機械に適用させる。
+ * その時、 r13 と r14 に関数と引数が残っている。
+ * プリミティブならその場で grass_jit_apply_primitive() を呼び、
+ * 次の App の処理に進む。
+ */
+static void
+grass_jit_emit_app(struct grass_jit_buffer *buf, size_t pc,
+                   const struct grass_opcode *op, struct grass_jit_fixups *fixups)
+{
+	grass_jit_emit_lookup(buf, op->content.app.func_index, 0);
+	grass_jit_emit_lookup(buf, op->content.app.arg_index, 1);
+
+	/* test r13b, GRASS_VALUE_TAG_MASK  (クロージャはタグが 0)
+	 * jz exit
+	 */
+	GRASS_JIT_EMIT(buf, 0x41, 0xf6, 0xc5);
+	grass_jit_emit_u8(buf, GRASS_VALUE_TAG_MASK);
+	fixups->call_exit = grass_jit_emit_jcc(buf, 0x84);
+
+	/* mov rdi, rbx
+	 * mov rsi, pc
+	 * mov rdx, r13
+	 * mov rcx, r14
+	 * call grass_jit_apply_primitive
+	 * test eax, eax
+	 * jz error
+	 */
+	GRASS_JIT_EMIT(buf, 0x48, 0x89, 0xdf, 0x48, 0xbe);
+	grass_jit_emit_u64(buf, pc);
+	GRASS_JIT_EMIT(buf, 0x4c, 0x89, 0xea, 0x4c, 0x89, 0xf1);
+	grass_jit_emit_call(buf, (const void *)grass_jit_apply_primitive);
+	GRASS_JIT_EMIT(buf, 0x85, 0xc0);
+	fixups->error = grass_jit_emit_jcc(buf, 0x84);
+}
+
+
+/*! mov rax, imm64 */
+static void
+grass_jit_emit_result(struct grass_jit_buffer *buf, size_t value)
+{
+	GRASS_JIT_EMIT(buf, 0x48, 0xb8);
+	grass_jit_emit_u64(buf, value);
+}
+
+
+/*!
+ * 書き込み先の領域に length バイトの空きを用意し、書き込み可能にする。
+ *
+ * \retval zero     失敗。
+ * \retval non-zero 成功。
+ */
+static int
+grass_jit_reserve(struct grass_jit *jit, size_t length)
+{
+	if((jit->area == NULL) || (jit->area_size - jit->area_used < length))
+	{
+		size_t size = GRASS_JIT_AREA_SIZE;
+		void *area;
+
+		while(size < length)
+		{
+			size *= 2;
+		}
+		area = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(area == MAP_FAILED)
+		{
+			return 0;
+		}
+		/* 古い領域のコードはそのまま使い続ける。 */
+		jit->area = (unsigned char *)area;
+		jit->area_used = 0;
+		jit->area_size = size;
+
+		return 1;
+	}
+
+	return mprotect(jit->area, jit->area_size, PROT_READ | PROT_WRITE) == 0;
+}
+
+
+/*!
+ * \a code から始まる抽象の本体を変換する。
+ *
+ * 本体は App の並びと終端の RET でなければならない。
+ * 生成するコードの構成は以下の通り。
+ * 	- プロローグ: レジスタを退避し、 rbx = machine, r12 = &machine->env
+ * 	  として、引数で渡された App の処理に飛ぶ。
+ * 	- 各 App の処理。
+ * 	- 終端: RET の位置を返す。
+ * 	- エピローグ。
+ * 	- 各 App の出口: その App の位置を返す。クロージャの適用なら
+ * 	  取り出した関数と引数を machine->native_func, native_arg に置く。
+ * 	- エラーの出口: GRASS_NATIVE_ERROR を返す。
+ *
+ * \retval zero     変換できなかった。抽象機械がそのまま実行する。
+ * \retval non-zero 成功。
+ */
+static int
+grass_jit_compile(struct grass_jit *jit, size_t code)
+{
+	const struct grass_opcode *ops = jit->program->ops;
+	struct grass_jit_fixups *fixups;
+	struct grass_jit_buffer buf;
+	const unsigned char *epilogue;
+	const unsigned char *error;
+	size_t num_apps;
+	size_t i;
+
+	for(num_apps = 0; ops[code + num_apps].type == GRASS_OP_APPLICATION; num_apps++)
+	{
+		if(jit->entries[code + num_apps].fragment != NULL)
+		{
+			/* 他の本体と重なっている。 */
+			return 0;
+		}
+	}
+	if(ops[code + num_apps].type != GRASS_OP_RETURN)
+	{
+		return 0;
+	}
+
+	fixups = (struct grass_jit_fixups *)GC_MALLOC_ATOMIC(
+	               (num_apps + 1) * sizeof(fixups[0]));
+	if(fixups == NULL)
+	{
+		return 0;
+	}
+	if(!grass_jit_reserve(jit, GRASS_JIT_MAX_FRAME_LENGTH
+	                           + num_apps * GRASS_JIT_MAX_APP_LENGTH))
+	{
+		return 0;
+	}
+
+	buf.start = buf.p = jit->area + jit->area_used;
+
+	/* push rbx; push r12; push r13; push r14
+	 * sub rsp, 8 (call 時に rsp を 16 バイト境界に揃える)
+	 * mov rbx, rdi
+	 * lea r12, [rbx + env]
+	 * jmp rsi
+	 */
+	GRASS_JIT_EMIT(&buf, 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56,
+	                     0x48, 0x83, 0xec, 0x08, 0x48, 0x89, 0xfb, 0x4c, 0x8d, 0xa3);
+	grass_jit_emit_u32(&buf, offsetof(struct grass_machine, env));
+	GRASS_JIT_EMIT(&buf, 0xff, 0xe6);
+
+	for(i = 0; i < num_apps; i++)
+	{
+		jit->entries[code + i].body = buf.start;
+		jit->entries[code + i].fragment = buf.p;
+		jit->native_code[code + i] = grass_jit_enter;
+		grass_jit_emit_app(&buf, code + i, &ops[code + i], &fixups[i]);
+	}
+
+	grass_jit_emit_result(&buf, code + num_apps);
+
+	/* add rsp, 8; pop r14; pop r13; pop r12; pop rbx; ret */
+	epilogue = buf.p;
+	GRASS_JIT_EMIT(&buf, 0x48, 0x83, 0xc4, 0x08,
+	                     0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3);
+
+	for(i = 0; i < num_apps; i++)
+	{
+		/* mov [rbx + native_func], r13
+		 * mov [rbx + native_arg], r14
+		 */
+		grass_jit_patch(&buf, fixups[i].call_exit, buf.p);
+		GRASS_JIT_EMIT(&buf, GRASS_JIT_REX_VALUE, 0x89, 0xab);
+		grass_jit_emit_u32(&buf, offsetof(struct grass_machine, native_func));
+		GRASS_JIT_EMIT(&buf, GRASS_JIT_REX_VALUE, 0x89, 0xb3);
+		grass_jit_emit_u32(&buf, offsetof(struct grass_machine, native_arg));
+		grass_jit_emit_result(&buf, code + i);
+		grass_jit_emit_jmp(&buf, epilogue);
+	}
+
+	/* mov rax, -1 */
+	error = buf.p;
+	GRASS_JIT_EMIT(&buf, 0x48, 0xc7, 0xc0, 0xff, 0xff, 0xff, 0xff);
+	grass_jit_emit_jmp(&buf, epilogue);
+	for(i = 0; i < num_apps; i++)
+	{
+		grass_jit_patch(&buf, fixups[i].error, error);
+	}
+
+	assert((size_t)(buf.p - buf.start)
+	       <= GRASS_JIT_MAX_FRAME_LENGTH + num_apps * GRASS_JIT_MAX_APP_LENGTH);
+	jit->area_used += (size_t)(buf.p - buf.start);
+	jit->num_compiled++;
+
+	if(mprotect(jit->area, jit->area_size, PROT_READ | PROT_EXEC) != 0)
+	{
+		/* 実行できないコードへの入口は消しておく。 */
+		for(i = 0; i < num_apps; i++)
+		{
+			jit->entries[code + i].body = NULL;
+			jit->entries[code + i].fragment = NULL;
+			jit->native_code[code + i] = NULL;
+		}
+		jit->num_compiled--;
+		return 0;
+	}
+
+	return 1;
+}
+
+#endif /* GRASS_JIT_SUPPORTED */
+
+
+/*!
+ * JIT を作成する。
+ *
+ * \param program       変換元のプログラム。
+ * \param error_message エラー時にエラーを説明する文字列が格納される。
+ *                      NULL は不可。
+ *
+ * \return 作成した JIT 。この環境で JIT を使えない場合やメモリ不足の場合は NULL 。
+ */
+struct grass_jit *
+grass_create_jit(const struct grass_program *program, char **error_message)
+{
+#if defined(GRASS_JIT_SUPPORTED)
+	struct grass_jit *jit;
+	size_t i;
+
+	assert(program != NULL);
+	assert(error_message != NULL);
+	*error_message = NULL;
+
+	/* 生成するコードは disp8 でフィールドを参照する。 */
+	assert(offsetof(struct grass_value_node, value) == 0);
+	assert(offsetof(struct grass_value_node, size) < 0x80);
+
+	jit = (struct grass_jit *)GC_MALLOC(sizeof(*jit));
+	if(jit == NULL)
+	{
+		*error_message = strerror(errno);
+		return NULL;
+	}
+
+	jit->program = program;
+	jit->entries = (struct grass_jit_entry *)GC_MALLOC_ATOMIC(
+	                     program->num_ops * sizeof(jit->entries[0]));
+	jit->native_code = (grass_native_code *)GC_MALLOC_ATOMIC(
+	                         program->num_ops * sizeof(jit->native_code[0]));
+	jit->call_counts = (unsigned int *)GC_MALLOC_ATOMIC(
+	                         program->num_ops * sizeof(jit->call_counts[0]));
+	if((jit->entries == NULL) || (jit->native_code == NULL)
+	|| (jit->call_counts == NULL))
+	{
+		*error_message = strerror(errno);
+		return NULL;
+	}
+	memset(jit->entries, 0, program->num_ops * sizeof(jit->entries[0]));
+	for(i = 0; i < program->num_ops; i++)
+	{
+		jit->native_code[i] = NULL;
+	}
+	memset(jit->call_counts, 0, program->num_ops * sizeof(jit->call_counts[0]));
+
+	jit->area = NULL;
+	jit->area_used = 0;
+	jit->area_size = 0;
+	jit->num_compiled = 0;
+
+	return jit;
+#else
+	(void)program;
+
+	*error_message = "JIT is not supported on this platform.";
+	return NULL;
+#endif
+}
+
+
+/*!
+ * \a code から始まる抽象の本体が呼ばれたことを記録する。
+ * 呼び出し回数が GRASS_JIT_THRESHOLD に達したら変換する。
+ * 変換に失敗した場合は何もしない (抽象機械がそのまま実行する)。
+ */
+void
+grass_jit_note_call(struct grass_jit *jit, size_t code)
+{
+	assert(jit != NULL);
+
+	if(jit->call_counts[code] < GRASS_JIT_THRESHOLD)
+	{
+		if(++jit->call_counts[code] == GRASS_JIT_THRESHOLD)
+		{
+#if defined(GRASS_JIT_SUPPORTED)
+			grass_jit_compile(jit, code);
+#endif
+		}
+	}
+}
+
+
+/*!
+ * 変換済みのコードを \a code の位置から実行する。
+ *
+ * 環境は machine->env から読み、実行後の環境を machine->env に書き戻す。
+ * 実行した App はすべてプリミティブの適用なので、
+ * 1命令が1ステップに当たる。
+ *
+ * \param machine 実行する抽象機械。 machine->jit->entries[code] は変換済みであること。
+ * \param code    実行を開始する App の位置。
+ *
+ * \return 抽象機械が実行を再開する位置。そこにある命令はまだ実行されていない。
+ *         エラー時は GRASS_NATIVE_ERROR を返す。
+ *
+ * \sa grass_native_code
+ */
+size_t
+grass_jit_enter(struct grass_machine *machine, size_t code)
+{
+#if defined(GRASS_JIT_SUPPORTED)
+	const struct grass_jit_entry *entry = &machine->jit->entries[code];
+
+	assert(entry->fragment != NULL);
+
+	return ((grass_jit_code)entry->body)(machine, entry->fragment);
+#else
+	(void)machine;
+	(void)code;
+
+	assert(0); /* BUG! */
+	return GRASS_NATIVE_ERROR;
+#endif
+}
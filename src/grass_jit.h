@@ -0,0 +1,67 @@
+/* $Id$ */
+/*! \file
+ * \brief 抽象の本体をネイティブコード (x86-64) に変換する JIT 。
+ *
+ * 何度も呼ばれた抽象の本体 (App の並びと終端の RET) を、
+ * 環境の参照とプリミティブの適用を直接行うネイティブコードに変換する。
+ * クロージャの適用や、範囲外参照などの例外的な状況では、
+ * その App の位置で抽象機械 (grass_run_machine()) に処理を戻す。
+ *
+ * 対応しているのは Linux x86-64 (GCC) のみ。それ以外の環境では
+ * grass_create_jit() が失敗する。
+ *
+ * \date 2009-01-06
+ * \author yoh2
+ * $LastChangedBy$
+ * $LastChangedDate$
+ */
+#ifndef grass_jit_H_
+#define grass_jit_H_
+
+#include <stddef.h>
+#include "grass_fwd.h"
+#include "grass_machine.h"
+
+/*! 抽象の本体を変換するまでの呼び出し回数。 */
+#define GRASS_JIT_THRESHOLD 32
+
+/*!
+ * 変換済みのコードへの入口。 program->ops の各位置に対応する。
+ */
+struct grass_jit_entry
+{
+	const unsigned char *body;     /*!< \brief 本体の入口 (プロローグ)。未変換なら NULL */
+	const unsigned char *fragment; /*!< \brief この App の処理の先頭 */
+};
+
+struct grass_jit
+{
+	const struct grass_program *program;
+
+	struct grass_jit_entry *entries; /*!< \brief 要素数は program->num_ops */
+	/*! machine->native_code として使う。変換済みの App には grass_jit_enter() が入る。 */
+	grass_native_code *native_code;
+	unsigned int *call_counts;       /*!< \brief 抽象の本体ごとの呼び出し回数 */
+
+	/*! 変換結果を書き込む領域 (mmap で確保)。 */
+	unsigned char *area;
+	size_t area_used;
+	size_t area_size;
+
+	size_t num_compiled; /*!< \brief 変換した本体の数 */
+};
+
+
+/* JIT を作成する。 */
+struct grass_jit *
+grass_create_jit(const struct grass_program *program, char **error_message);
+
+/* 抽象の本体の呼び出しを記録し、十分に呼ばれていれば変換する。 */
+void
+grass_jit_note_call(struct grass_jit *jit, size_t code);
+
+/* 変換済みのコードを code の位置から実行する。 */
+size_t
+grass_jit_enter(struct grass_machine *machine, size_t code);
+
+#endif /* grass_jit_H_ */
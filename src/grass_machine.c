@@ -10,9 +10,15 @@
 
 #include "grass_machine.h"
 #include "grass_value.h"
+#include "grass_bytecode.h"
+#include "grass_jit.h"
+#include "grass_arena.h"
+#include "grass_gc.h"
 #include "grass_instruction.h"
+#include "static_assert.h"
 #include <stdio.h>
 #include <gc.h>
+#include <gc/gc_typed.h>
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
@@ -21,121 +27,625 @@
 
 
 
+static int
+grass_stdio_get_char(void *context)
+{
+	(void)context;
+	return getchar();
+}
+
+
+static void
+grass_stdio_put_char(int c, void *context)
+{
+	(void)context;
+	putchar(c);
+}
+
+
+const struct grass_io grass_stdio = {
+	grass_stdio_get_char,
+	grass_stdio_put_char,
+	NULL
+};
+
+
 /*!
  * 初期環境を作成する。
  *
  * 初期環境: Out :: Succ :: w :: In :: ε
  *
+ * セルは他と同じく環境スタックに積み、最初に捕捉される時にヒープへ移す。
+ * GRASS_COMPACT_HEAP では、環境スタック上のセルは GC で動かないので、
+ * 評価器 (grass_eval.c) がローカル変数に持つ環境も動かずに済む。
+ *
  * \return 初期環境。失敗時は NULL 。
  */
 static struct grass_value_node *
-create_initial_environment(void)
+create_initial_environment(struct grass_machine *machine)
 {
+	static const grass_value initial_values[] = {
+		GRASS_IN_VALUE,
+		GRASS_NUMERIC_VALUE('w'),
+		GRASS_SUCC_VALUE,
+		GRASS_OUT_VALUE
+	};
 	struct grass_value_node *initial_env = NULL;
-	struct grass_value_node *node;
+	size_t i;
+
+	STATIC_ASSERT(sizeof(initial_values) / sizeof(initial_values[0])
+	              == GRASS_INITIAL_ENV_DEPTH);
 
-	node = grass_create_in_func_node();
-	if(node == NULL)
+	for(i = 0; i < sizeof(initial_values) / sizeof(initial_values[0]); i++)
 	{
-		return NULL;
+		initial_env = grass_push_env_cell(machine, initial_values[i], initial_env);
+		if(initial_env == NULL)
+		{
+			return NULL;
+		}
 	}
-	node->next = initial_env;
-	initial_env = node;
 
-	node = grass_create_numeric_node('w');
-	if(node == NULL)
+	return initial_env;
+}
+
+
+/*! Dump の初期確保フレーム数 */
+#define GRASS_INITIAL_DUMP_CAPACITY 64
+
+static struct grass_env_chunk *
+grass_create_env_chunk(struct grass_env_chunk *prev)
+{
+	struct grass_env_chunk *new_chunk
+		= GRASS_ALLOC_ENV_CHUNK();
+	if(new_chunk == NULL)
 	{
 		return NULL;
 	}
-	node->next = initial_env;
-	initial_env = node;
 
-	node = grass_create_succ_func_node();
-	if(node == NULL)
+	new_chunk->prev = prev;
+	new_chunk->next = NULL;
+	new_chunk->index = 0;
+	if(prev != NULL)
+	{
+		prev->next = new_chunk;
+		new_chunk->index = prev->index + 1;
+	}
+
+	return new_chunk;
+}
+
+
+/*!
+ * 環境スタックにセルをひとつ確保する。中身は初期化しない。
+ *
+ * \return 確保したセル。メモリ確保失敗時は NULL 。
+ */
+static struct grass_value_node *
+grass_alloc_env_cell(struct grass_machine *machine)
+{
+	struct grass_env_mark *top = &machine->env_top;
+
+	if(top->used == GRASS_ENV_CHUNK_CELLS)
+	{
+		if(top->chunk->next == NULL)
+		{
+			if(grass_create_env_chunk(top->chunk) == NULL)
+			{
+				return NULL;
+			}
+		}
+		top->chunk = top->chunk->next;
+		top->used = 0;
+	}
+
+	return &top->chunk->cells[top->used++];
+}
+
+
+/*!
+ * 環境スタックにセルを積み、 \a env の先頭に \a value を繋いだ環境を返す。
+ *
+ * 積んだセルは、現在の関数呼び出しから戻るか、末尾呼び出しを行うまで有効。
+ *
+ * \return 新しい環境。メモリ確保失敗時は NULL 。
+ */
+struct grass_value_node *
+grass_push_env_cell(struct grass_machine *machine,
+                    grass_value value,
+                    struct grass_value_node *env)
+{
+	struct grass_value_node *cell;
+
+	cell = grass_alloc_env_cell(machine);
+	if(cell == NULL)
 	{
 		return NULL;
 	}
-	node->next = initial_env;
-	initial_env = node;
+	cell->value = value;
+	grass_cons_value_node(cell, env);
+	GRASS_RC_RETAIN_CELL(cell);
+
+	return cell;
+}
+
+
+#if defined(GRASS_REFCOUNT_HEAP)
+/*!
+ * 現在の呼び出しが積んだセルを捨て、 env_top を env_base に戻す。
+ * セルが指すものの参照カウントを減らす。
+ */
+void
+grass_drop_env_cells(struct grass_machine *machine)
+{
+	struct grass_env_mark pos = machine->env_base;
+
+	while((pos.chunk != machine->env_top.chunk) || (pos.used != machine->env_top.used))
+	{
+		if(pos.used == GRASS_ENV_CHUNK_CELLS)
+		{
+			pos.chunk = pos.chunk->next;
+			pos.used = 0;
+			continue;
+		}
+		GRASS_RC_RELEASE_CELL(&pos.chunk->cells[pos.used++]);
+	}
+	machine->env_top = machine->env_base;
+}
+#endif
 
-	node = grass_create_out_func_node();
-	if(node == NULL)
+
+#if !defined(GRASS_COMPACT_HEAP)
+static struct grass_closure_chunk *
+grass_create_closure_chunk(void)
+{
+	struct grass_closure_chunk *new_chunk = grass_gc_alloc_closure_chunk();
+	if(new_chunk == NULL)
 	{
 		return NULL;
 	}
-	node->next = initial_env;
-	initial_env = node;
 
-	return initial_env;
+	new_chunk->next = NULL;
+
+	return new_chunk;
 }
 
 
-static struct grass_value_node *
-create_initial_dump(void)
+/*!
+ * クロージャ \a func を \a arg に部分適用したクロージャを、
+ * 現在の関数呼び出しのクロージャスタックに作成する。
+ * grass_create_partial_application() と同じだが、引数のセルも環境スタックに置く。
+ *
+ * どちらも戻る時か末尾呼び出しの時に捨てられるので、結果がエスケープしない
+ * (grass_opcode の app.local が立っている) App でのみ使うこと。
+ * 作るクロージャの環境が環境スタック上にあっても、それを参照するのは
+ * 同じ呼び出しの中か、そこからの末尾でない呼び出しの中だけになる。
+ *
+ * \return 作成した値。失敗時は GRASS_NO_VALUE 。
+ */
+grass_value
+grass_create_local_partial_application(struct grass_machine *machine,
+                                       grass_value func, grass_value arg)
+{
+	struct grass_closure_mark *top = &machine->closure_top;
+	struct grass_value_node *arg_cell;
+	struct grass_closure *closure;
+
+	assert(GRASS_IS_CLOSURE(func) && (GRASS_CLOSURE(func)->num_args > 1));
+
+	arg_cell = grass_alloc_env_cell(machine);
+	if(arg_cell == NULL)
+	{
+		return GRASS_NO_VALUE;
+	}
+	arg_cell->value = arg;
+	grass_cons_value_node(arg_cell, GRASS_NODE_PTR(GRASS_CLOSURE(func)->env));
+
+	if(top->used == GRASS_CLOSURE_CHUNK_CLOSURES)
+	{
+		if(top->chunk->next == NULL)
+		{
+			top->chunk->next = grass_create_closure_chunk();
+			if(top->chunk->next == NULL)
+			{
+				return GRASS_NO_VALUE;
+			}
+		}
+		top->chunk = top->chunk->next;
+		top->used = 0;
+	}
+	closure = &top->chunk->closures[top->used++];
+	closure->code = GRASS_CLOSURE(func)->code;
+	closure->num_args = GRASS_CLOSURE(func)->num_args - 1;
+	closure->env = arg_cell;
+	machine->num_local_closures++;
+
+	return GRASS_CLOSURE_VALUE(closure);
+}
+#endif
+
+
+/*!
+ * Dump にフレームを積む。必要なら Dump を伸長する。
+ *
+ * \retval zero     メモリ確保失敗。 errno が設定される。
+ * \retval non-zero 成功。
+ */
+static int
+grass_push_dump_frame(struct grass_machine *machine, size_t code, struct grass_value_node *env)
 {
-	struct grass_value_node *initial_dump = NULL;
-	struct grass_value_node *node;
-	struct grass_instruction_node *code;
+	assert(machine != NULL);
+
+	if(machine->dump_depth == machine->dump_capacity)
+	{
+		size_t new_capacity = machine->dump_capacity * 2;
+		struct grass_dump_frame *new_dump;
+
+		new_dump = (struct grass_dump_frame *)GC_REALLOC(
+		                 machine->dump,
+		                 new_capacity * sizeof(new_dump[0]));
+		if(new_dump == NULL)
+		{
+			return 0;
+		}
+		machine->dump = new_dump;
+		machine->dump_capacity = new_capacity;
+	}
+
+	machine->dump[machine->dump_depth].code = code;
+	machine->dump[machine->dump_depth].env = env;
+	machine->dump[machine->dump_depth].env_base = machine->env_base;
+#if !defined(GRASS_COMPACT_HEAP)
+	machine->dump[machine->dump_depth].closure_base = machine->closure_base;
+#endif
+	machine->dump_depth++;
+
+	return 1;
+}
+
+
+/*!
+ * 初期 Dump を作成する。
+ *
+ * 初期 Dump: (App(1, 1)::ε, ε) :: (ε, ε) :: ε
+ *
+ * \return 成功時は非ゼロ。
+ */
+static int
+create_initial_dump(struct grass_machine *machine)
+{
+	machine->dump = (struct grass_dump_frame *)GC_MALLOC(
+	                      GRASS_INITIAL_DUMP_CAPACITY * sizeof(machine->dump[0]));
+	if(machine->dump == NULL)
+	{
+		return 0;
+	}
+	machine->dump_depth = 0;
+	machine->dump_capacity = GRASS_INITIAL_DUMP_CAPACITY;
 
 	/* (ε, ε) */
-	node = grass_create_closure_node(NULL, NULL);
-	if(node == NULL)
+	if(!grass_push_dump_frame(machine, machine->program->empty, NULL))
 	{
-		return NULL;
+		return 0;
 	}
-	node->next = initial_dump;
-	initial_dump = node;
 
 	/* (App(1, 1) :: ε, ε) */
-	code = grass_create_application_node(1, 1);
-	if(code == NULL)
+	if(!grass_push_dump_frame(machine, machine->program->main_call, NULL))
 	{
-		return NULL;
+		return 0;
+	}
+
+	return 1;
+}
+
+
+struct grass_machine *
+grass_create_machine(const struct grass_program *program, char **error_message)
+{
+	return grass_create_machine_with_heap_limit(program, 0, error_message);
+}
+
+
+/*!
+ * GC のヒープに抽象機械を確保する。
+ * ステップ数や位置などの整数の欄は GC に辿らせない。
+ * GRASS_COMPACT_HEAP の場合、値はアリーナ中のオフセットなので辿らない。
+ *
+ * \return 確保した抽象機械。失敗時は NULL 。
+ */
+static struct grass_machine *
+grass_alloc_machine(void)
+{
+	static GC_descr descr;
+	static int descr_ready = 0;
+
+	if(!descr_ready)
+	{
+		GC_word bitmap[GC_BITMAP_SIZE(struct grass_machine)];
+
+		memset(bitmap, 0, sizeof(bitmap));
+		GC_set_bit(bitmap, GC_WORD_OFFSET(struct grass_machine, program));
+		GC_set_bit(bitmap, GC_WORD_OFFSET(struct grass_machine, io));
+		GC_set_bit(bitmap, GC_WORD_OFFSET(struct grass_machine, env));
+		GC_set_bit(bitmap, GC_WORD_OFFSET(struct grass_machine, env_top.chunk));
+		GC_set_bit(bitmap, GC_WORD_OFFSET(struct grass_machine, env_base.chunk));
+#if !defined(GRASS_COMPACT_HEAP)
+		GC_set_bit(bitmap, GC_WORD_OFFSET(struct grass_machine, closure_top.chunk));
+		GC_set_bit(bitmap, GC_WORD_OFFSET(struct grass_machine, closure_base.chunk));
+#endif
+		GC_set_bit(bitmap, GC_WORD_OFFSET(struct grass_machine, dump));
+		GC_set_bit(bitmap, GC_WORD_OFFSET(struct grass_machine, native_code));
+		GC_set_bit(bitmap, GC_WORD_OFFSET(struct grass_machine, native_error_message));
+		GC_set_bit(bitmap, GC_WORD_OFFSET(struct grass_machine, jit));
+#if defined(GRASS_COMPACT_HEAP)
+		GC_set_bit(bitmap, GC_WORD_OFFSET(struct grass_machine, arena));
+#else
+		GC_set_bit(bitmap, GC_WORD_OFFSET(struct grass_machine, true_value));
+		GC_set_bit(bitmap, GC_WORD_OFFSET(struct grass_machine, false_value));
+		GC_set_bit(bitmap, GC_WORD_OFFSET(struct grass_machine, native_func));
+		GC_set_bit(bitmap, GC_WORD_OFFSET(struct grass_machine, native_arg));
+#endif
+		descr = GC_make_descriptor(bitmap, GC_WORD_LEN(struct grass_machine));
+		descr_ready = 1;
 	}
-	node = grass_create_closure_node(code, NULL);
-	if(node == NULL)
+
+	return (struct grass_machine *)GC_MALLOC_EXPLICITLY_TYPED(sizeof(struct grass_machine),
+	                                                          descr);
+}
+
+
+/*!
+ * 作成中の抽象機械 \a machine の確保に失敗した時のエラーの説明。
+ * アリーナの上限に達した場合は、上限が小さすぎることを伝える。
+ */
+static char *
+grass_creation_error_message(const struct grass_machine *machine)
+{
+#if defined(GRASS_COMPACT_HEAP)
+	if(machine->arena->exhausted)
 	{
-		return NULL;
+		return "runtime error: heap limit is too small to create the machine.";
 	}
-	node->next = initial_dump;
-	initial_dump = node;
+#else
+	(void)machine;
+#endif
 
-	return initial_dump;
+	return strerror(errno);
 }
 
 
+/*!
+ * 初期状態の抽象機械を作成する。
+ *
+ * \param heap_limit    ヒープ (アリーナ) の上限 (バイト) 。 0 なら既定値。
+ *                      GRASS_COMPACT_HEAP でない場合は無視される。
+ * \param error_message エラー時にエラーを説明する文字列が格納される。
+ *                      NULL は不可。
+ *
+ * \return 作成した抽象機械。失敗時は NULL 。
+ */
 struct grass_machine *
-grass_create_machine(struct grass_instruction_node *code)
+grass_create_machine_with_heap_limit(const struct grass_program *program,
+                                     size_t heap_limit, char **error_message)
 {
 	struct grass_machine *new_machine;
 
-	new_machine = (struct grass_machine *)GC_MALLOC(sizeof(*new_machine));
+	assert(error_message != NULL);
+
+	new_machine = grass_alloc_machine();
 	if(new_machine == NULL)
 	{
+		*error_message = strerror(errno);
 		return NULL;
 	}
 
-	new_machine->code = code;
-	new_machine->env = create_initial_environment();
-	new_machine->dump = create_initial_dump();
-
-	if((new_machine->env == NULL) || (new_machine->dump == NULL))
+#if defined(GRASS_COMPACT_HEAP)
+	new_machine->arena = grass_create_arena(heap_limit);
+	if(new_machine->arena == NULL)
+	{
+		*error_message = strerror(errno);
+		return NULL;
+	}
+	grass_enter_arena(new_machine->arena);
+	new_machine->gc_env_floor = 0;
+	new_machine->gc_dump_floor = 0;
+#else
+	(void)heap_limit;
+#endif
+
+	new_machine->program = program;
+	new_machine->io = &grass_stdio;
+	new_machine->code = program->entry;
+	new_machine->true_value = grass_create_true_value(program);
+	new_machine->false_value = grass_create_false_value(program);
+	new_machine->native_code = NULL;
+	new_machine->native_error_message = NULL;
+	new_machine->native_func = GRASS_NO_VALUE;
+	new_machine->native_arg = GRASS_NO_VALUE;
+	new_machine->jit = NULL;
+
+	new_machine->env_top.chunk = grass_create_env_chunk(NULL);
+	if(new_machine->env_top.chunk == NULL)
+	{
+		*error_message = grass_creation_error_message(new_machine);
+		return NULL;
+	}
+	new_machine->env_top.used = 0;
+	new_machine->env_base = new_machine->env_top;
+#if !defined(GRASS_COMPACT_HEAP)
+	new_machine->closure_top.chunk = grass_create_closure_chunk();
+	if(new_machine->closure_top.chunk == NULL)
+	{
+		*error_message = grass_creation_error_message(new_machine);
+		return NULL;
+	}
+	new_machine->closure_top.used = 0;
+	new_machine->closure_base = new_machine->closure_top;
+	new_machine->num_local_closures = 0;
+#endif
+	new_machine->env = create_initial_environment(new_machine);
+
+	if((new_machine->env == NULL)
+	|| (new_machine->true_value == GRASS_NO_VALUE)
+	|| (new_machine->false_value == GRASS_NO_VALUE)
+	|| !create_initial_dump(new_machine))
 	{
 		/* GC_FREEしておくべき？ */
+		*error_message = grass_creation_error_message(new_machine);
 		return NULL;
 	}
+	/* true/false は機械が無くなるまで共有されるので、一度だけ数えておく。 */
+	GRASS_RC_RETAIN_VALUE(new_machine->true_value);
+	GRASS_RC_RETAIN_VALUE(new_machine->false_value);
 
 	return new_machine;
 }
 
 
+/*!
+ * 抽象機械が \a jit を使うようにする。
+ * 以後、何度も呼ばれた抽象の本体はネイティブコードに変換して実行される。
+ */
+void
+grass_attach_jit(struct grass_machine *machine, struct grass_jit *jit)
+{
+	assert(machine != NULL);
+	assert(jit != NULL);
+
+	machine->jit = jit;
+	machine->native_code = jit->native_code;
+}
+
+
+/*!
+ * 1ステップだけ実行する。
+ * grass_run_machine() を1ステップに制限して呼ぶのと同じ。
+ */
 int
 grass_step_machine(struct grass_machine *machine, char **error_message)
 {
+	assert(machine != NULL);
+	assert(!grass_machine_done(machine));
+
+	return grass_run_machine(machine, 1, NULL, error_message);
+}
+
+
+/*
+ * grass_run_machine() の命令ディスパッチ。
+ * GCC 系ではラベルのアドレスによる threaded code に、それ以外では
+ * switch による分岐になる。
+ * App は、 native が非 0 ならネイティブコードを探す op_native_application に、
+ * そうでなければ op_application に分岐する。
+ */
+#if defined(__GNUC__)
+#define GRASS_DISPATCH_TO(type) goto *dispatch_table[(type)]
+#else
+#define GRASS_DISPATCH_TO(type)                       \
+	switch(type)                                  \
+	{                                             \
+	case GRASS_OP_APPLICATION:                    \
+		if(native)                            \
+		{                                     \
+			goto op_native_application;   \
+		}                                     \
+		goto op_application;                  \
+	case GRASS_OP_ABSTRACTION: goto op_abstraction; \
+	case GRASS_OP_RETURN:      goto op_return;      \
+	default:                   goto internal_error; \
+	}
+#endif
+
+/*
+ * ヒープに確保する命令の後で、必要なら GC を行う。
+ * ヒープ上のオブジェクトを指すローカル変数は env だけなので、
+ * machine に書き戻して GC し、読み直す。
+ */
+#if defined(GRASS_COMPACT_HEAP) && !defined(GRASS_REFCOUNT_HEAP)
+#define GRASS_MACHINE_SAFE_POINT()                                   \
+	do                                                           \
+	{                                                            \
+		machine->env = env;                                  \
+		if(!GRASS_GC_SAFE_POINT(machine, error_message))     \
+		{                                                    \
+			result = 0;                                  \
+			goto suspend;                                \
+		}                                                    \
+		env = machine->env;                                  \
+	}while(0)
+#else
+#define GRASS_MACHINE_SAFE_POINT() ((void)0)
+#endif
+
+#define GRASS_DISPATCH()                  \
+	do                                \
+	{                                 \
+		if(steps >= limit)        \
+		{                         \
+			goto suspend;     \
+		}                         \
+		op = &ops[code];          \
+		GRASS_DISPATCH_TO(op->type); \
+	}while(0)
+
+
+/*!
+ * 抽象機械を、終了するか \a max_steps ステップに達するまで実行する。
+ *
+ * 実行中はレジスタ (code, env, Dump の深さ) をローカル変数に置き、
+ * クロージャの適用もこの中で行う。プリミティブの適用時のみ
+ * machine に書き戻して grass_apply_primitive() を呼ぶ。
+ *
+ * 環境に積むセルは環境スタックに置く。
+ * 	- 関数呼び出しでは、呼び出し元の env_base を Dump に保存し、
+ * 	  そこから先を呼び出し先のセル置き場にする。
+ * 	- 戻る時と末尾呼び出しの時は、現在の呼び出しのセルを全て捨てる。
+ * 	- クロージャを作る時は、捕捉する環境をヒープに移す。
+ * クロージャの環境は常にヒープ上にあるので、捨てたセルが参照されることはない。
+ *
+ * ネイティブコードは、 \a max_steps が 0 の場合だけ使う。
+ *
+ * \param machine       実行する抽象機械。終了状態であってもよい。
+ * \param max_steps     実行する最大ステップ数。 0 なら無制限。
+ * \param num_steps     実行したステップ数が格納される。 NULL 可。
+ * \param error_message エラー時にエラーを説明する文字列が格納される。 NULL 可。
+ *
+ * \retval zero     エラー発生。
+ * \retval non-zero 終了したか、 \a max_steps に達した。
+ *                  どちらであるかは grass_machine_done() で判定する。
+ */
+int
+grass_run_machine(struct grass_machine *machine, size_t max_steps,
+                  size_t *num_steps, char **error_message)
+{
+#if defined(__GNUC__)
+	static const void *const native_dispatch_table[] = {
+		[GRASS_OP_APPLICATION] = &&op_native_application,
+		[GRASS_OP_ABSTRACTION] = &&op_abstraction,
+		[GRASS_OP_RETURN]      = &&op_return
+	};
+	static const void *const plain_dispatch_table[] = {
+		[GRASS_OP_APPLICATION] = &&op_application,
+		[GRASS_OP_ABSTRACTION] = &&op_abstraction,
+		[GRASS_OP_RETURN]      = &&op_return
+	};
+	const void *const *dispatch_table;
+#endif
 	char *dummy_error_message;
+	const struct grass_opcode *ops;
+	const struct grass_opcode *op;
+	size_t code;
+	struct grass_value_node *env;
+	grass_value func;
+	grass_value arg;
+	grass_value value;
+	size_t callee;
+	struct grass_value_node *callee_env;
+	int native;
+	size_t steps = 0;
+	size_t limit = (max_steps == 0)? (size_t)-1: max_steps;
+	int result = 1;
 
 	assert(machine != NULL);
-	assert(!grass_machine_done(machine));
 
 	if(error_message == NULL)
 	{
@@ -143,123 +653,308 @@ grass_step_machine(struct grass_machine *machine, char **error_message)
 	}
 	*error_message = NULL;
 
-	if(machine->env == NULL)
-	{
-		*error_message = "runtime error: internal error.";
-		return 0;
-	}
+#if defined(GRASS_COMPACT_HEAP)
+	grass_enter_arena(machine->arena);
+#endif
+
+	ops = machine->program->ops;
+	code = machine->code;
+	env = machine->env;
+
+	native = (machine->native_code != NULL) && (max_steps == 0);
+#if defined(__GNUC__)
+	dispatch_table = native? native_dispatch_table: plain_dispatch_table;
+#endif
+
+	GRASS_DISPATCH();
 
-	if(machine->code == NULL)
+op_return:
 	{
 		/* (ε, f::E, (C', E')::D) → (C', f::E', D) */
-		struct grass_value_node *dump_top = machine->dump;
+		const struct grass_dump_frame *frame;
 
-		assert(dump_top->value.type == GRASS_VT_CLOSURE);
+		if(machine->dump_depth == 0)
+		{
+			/* 終了 */
+			goto suspend;
+		}
 
-		machine->code = dump_top->value.content.closure.code;
-		machine->env->next = dump_top->value.content.closure.env;
-		machine->dump = machine->dump->next;
-	}
-	else if(machine->code->inst.type == GRASS_IT_APPLICATION)
-	{
-		/* (App(m, n)::C, E, D) → (Cm, (Cn, En)::Em, (C, E)::D)
-		 * 	where E = (C1, E1)::(C2, E2):: ... ::(Ci, Ei)::E' (i = m, n)
-		 */
-		struct grass_instruction_node *code_top = machine->code;
-		struct grass_value_node *func_node;
-		struct grass_value_node *arg_node;
-
-		func_node = grass_get_nth_value_node(
-		                  machine->env,
-		                  code_top->inst.content.app.func_index);
-		arg_node = grass_get_nth_value_node(
-		                 machine->env,
-		                 code_top->inst.content.app.arg_index);
-		if((func_node == NULL) || (arg_node == NULL))
+		/* 捨てるセルが指していることがあるので、積み終わるまで押さえておく。 */
+		value = env->value;
+		frame = &machine->dump[--machine->dump_depth];
+		GRASS_RC_RETAIN_VALUE(value);
+		GRASS_DROP_ENV_CELLS(machine);
+		machine->env_base = frame->env_base;
+#if !defined(GRASS_COMPACT_HEAP)
+		machine->closure_base = frame->closure_base;
+#endif
+		GRASS_GC_NOTE_RETURN(machine);
+
+		env = grass_push_env_cell(machine, value, frame->env);
+		GRASS_RC_RELEASE_VALUE(value);
+		if(env == NULL)
 		{
-			*error_message = "runtime error: stack out of range.";
-			return 0;
+			goto memory_error;
 		}
-		return grass_apply(machine, &func_node->value, &arg_node->value, error_message);
+		code = frame->code;
 	}
-	else if(machine->code->inst.content.abs.num_args == 1)
+	steps++;
+	GRASS_DISPATCH();
+
+op_abstraction:
 	{
 		/* (Abs(n, C')::C, E, D) → (C, (C', E)::E, D)
 		 * 	if n = 1
+		 * (Abs(n, C')::C, E, D) → (C, (Abs(n-1, C')::ε, E)::E, D)
+		 * 	if n > 1
+		 * 	(後者は、残り引数の数 n を持つクロージャで表す)
+		 * E のうち C' が参照する値だけを捕捉する (flat closure) ので、
+		 * E はヒープに移さなくてよい。
 		 */
-		struct grass_instruction_node *code_top = machine->code;
-		struct grass_value_node *closure_node;
+		const size_t *captures = &machine->program->captures[op->content.abs.captures];
+		grass_value closure;
 
-		machine->code = code_top->next;
-
-		closure_node = grass_create_closure_node(
-		                     code_top->inst.content.abs.code,
-		                     machine->env);
-		if(closure_node == NULL)
+		closure = grass_create_flat_closure(code + 1, op->content.abs.num_args,
+		                                    env, captures + 1, captures[0]);
+		if(closure == GRASS_NO_VALUE)
 		{
-			*error_message = strerror(errno);
-			return 0;
+			goto memory_error;
 		}
-		closure_node->next = machine->env;
-		machine->env = closure_node;
+		env = grass_push_env_cell(machine, closure, env);
+		if(env == NULL)
+		{
+			goto memory_error;
+		}
+		code += 1 + op->content.abs.body_length;
+		GRASS_MACHINE_SAFE_POINT();
 	}
-	else
+	steps++;
+	GRASS_DISPATCH();
+
+op_native_application:
+	if(machine->native_code[code] != NULL)
 	{
-		/* (Abs(n, C')::C, E, D) → (C, (Abs(n-1, C')::ε, E)::E, D)
-		 * 	if n > 1
+		/* ネイティブコードに変換済みの命令列。プリミティブの適用が続く間は
+		 * ネイティブコードで実行し、それ以外の命令に当たったらここに戻る。
 		 */
-		struct grass_instruction_node *code_top = machine->code;
-		struct grass_instruction_node *abs_node; /* Abs(n-1, C')::ε */
-		struct grass_value_node *closure_node;   /* (Abs(n-1, C')::ε, E) */
+		size_t next;
+
+		machine->env = env;
+		next = machine->native_code[code](machine, code);
+		env = machine->env;
+		if(next == GRASS_NATIVE_ERROR)
+		{
+			*error_message = machine->native_error_message;
+			result = 0;
+			goto suspend;
+		}
+		steps += next - code;
+		code = next;
+		op = &ops[code];
+		if(op->type != GRASS_OP_APPLICATION)
+		{
+			GRASS_DISPATCH_TO(op->type);
+		}
+		/* クロージャの適用。関数と引数は取り出し済み。 */
+		func = machine->native_func;
+		arg = machine->native_arg;
+		goto apply;
+	}
+	/* FALLTHROUGH */
+
+op_application:
+	/* 添字が範囲内であることは読み込み時に確かめてある。
+	 * 関数が分かっていれば、種類を確かめずに進む (grass_resolve_application() 参照) 。
+	 */
+	arg = grass_get_verified_value_node(env, op->content.app.arg_index)->value;
+	switch(grass_resolve_application(machine, op, env, arg,
+	                                 &func, &value, &callee, &callee_env))
+	{
+	case GRASS_APP_PUSH:
+		goto push_result;
 
-		machine->code = code_top->next;
+	case GRASS_APP_CALL:
+		goto call;
 
-		abs_node = grass_create_abstraction_node(
-		                 code_top->inst.content.abs.num_args - 1,
-		                 code_top->inst.content.abs.code);
-		if(abs_node == NULL)
+	default:
+		goto apply;
+	}
+
+push_result:
+	/* (App(m, n)::C, E, D) → (C, v::E, D) */
+	env = grass_push_env_cell(machine, value, env);
+	if(env == NULL)
+	{
+		goto memory_error;
+	}
+	code++;
+	steps++;
+	GRASS_DISPATCH();
+
+	{
+		/* (App(m, n)::C, E, D) → (Cm, (Cn, En)::Em, (C, E)::D)
+		 * 	where E = (C1, E1)::(C2, E2):: ... ::(Ci, Ei)::E' (i = m, n)
+		 */
+	apply:
+		if(!GRASS_IS_CLOSURE(func))
 		{
-			*error_message = strerror(errno);
-			return 0;
+			machine->code = code;
+			machine->env = env;
+			if(!grass_apply_primitive(machine, func, arg, error_message))
+			{
+				result = 0;
+				goto suspend;
+			}
+			code = machine->code;
+			env = machine->env;
 		}
-		closure_node = grass_create_closure_node(
-		                     abs_node,
-		                     machine->env);
-		if(closure_node == NULL)
+		else if(GRASS_CLOSURE(func)->num_args > 1)
 		{
-			*error_message = strerror(errno);
-			return 0;
+			/* 部分適用。
+			 * (App(m, n)::C, E, D) → (C, (C', (Cn, En)::Em)::E, D)
+			 * 	where (Cm, Em) = (Abs(k, C')::ε, Em)
+			 * 	      (Abs(k-1, C')::ε を実行してすぐに戻るのと同じ結果になる)
+			 * 作るクロージャが捕捉する環境なので、引数のセルはヒープに置く。
+			 * ただし結果がエスケープしない App では、どちらも現在の呼び出しの
+			 * クロージャスタックと環境スタックに置く。
+			 */
+			grass_value closure;
+
+#if !defined(GRASS_COMPACT_HEAP)
+			if(ops[code].content.app.local)
+			{
+				closure = grass_create_local_partial_application(machine, func, arg);
+			}
+			else
+#endif
+			{
+				closure = grass_create_partial_application(func, arg);
+			}
+			if(closure == GRASS_NO_VALUE)
+			{
+				goto memory_error;
+			}
+			env = grass_push_env_cell(machine, closure, env);
+			if(env == NULL)
+			{
+				goto memory_error;
+			}
+			code++;
+			GRASS_MACHINE_SAFE_POINT();
 		}
-		closure_node->next = machine->env;
-		machine->env = closure_node;
+		else
+		{
+			int tail_call;
+
+			callee = GRASS_CLOSURE(func)->code;
+			callee_env = GRASS_NODE_PTR(GRASS_CLOSURE(func)->env);
+		call:
+			tail_call = (ops[code + 1].type == GRASS_OP_RETURN);
+			if(!tail_call)
+			{
+				if(!grass_push_dump_frame(machine, code + 1, env))
+				{
+					goto memory_error;
+				}
+				GRASS_ENTER_CALL(machine);
+			}
+			else
+			{
+				/* 末尾呼び出しでは Dump に積まず、現在の呼び出しのセルを捨てる。
+				 * (App(m, n)::ε, E, D) → (Cm, (Cn, En)::Em, D)
+				 * 捨てるセルが func, arg を指していることがあるので、
+				 * 参照カウントを使う場合は積み終わるまで押さえておく。
+				 */
+				GRASS_RC_RETAIN_VALUE(func);
+				GRASS_RC_RETAIN_VALUE(arg);
+				GRASS_DROP_ENV_CELLS(machine);
+			}
+
+			env = grass_push_env_cell(machine, arg, callee_env);
+			code = callee;
+			if(tail_call)
+			{
+				GRASS_RC_RELEASE_VALUE(arg);
+				GRASS_RC_RELEASE_VALUE(func);
+			}
+			if(env == NULL)
+			{
+				goto memory_error;
+			}
+			if(machine->jit != NULL)
+			{
+				grass_jit_note_call(machine->jit, code);
+			}
+		}
+	}
+	steps++;
+	GRASS_DISPATCH();
+
+#if !defined(__GNUC__)
+internal_error:
+	assert(0); /* BUG! */
+	*error_message = "runtime error: internal error.";
+	result = 0;
+	goto suspend;
+#endif
+
+memory_error:
+	*error_message = GRASS_HEAP_ERROR_MESSAGE();
+	result = 0;
+
+suspend:
+	machine->code = code;
+	machine->env = env;
+	if(num_steps != NULL)
+	{
+		*num_steps = steps;
 	}
 
-	return 1;
+	return result;
 }
 
+#undef GRASS_DISPATCH
+#undef GRASS_DISPATCH_TO
+#undef GRASS_MACHINE_SAFE_POINT
+
 
 int
 grass_machine_done(const struct grass_machine *machine)
 {
 	assert(machine != NULL);
 
-	return (machine->code == NULL) && (machine->dump == NULL);
+	return (machine->program->ops[machine->code].type == GRASS_OP_RETURN)
+	    && (machine->dump_depth == 0);
 }
 
 
 void
 grass_dump_machine(const struct grass_machine *machine)
 {
+	size_t i;
+
+#if defined(GRASS_COMPACT_HEAP)
+	grass_enter_arena(machine->arena);
+#endif
+
 	printf("code: ");
-	grass_dump_instruction_list(machine->code);
+	grass_dump_code(machine->program, machine->code);
 	puts("");
 
 	printf("env : ");
-	grass_dump_value_list(machine->env);
+	grass_dump_value_list(machine->program, machine->env);
 	puts("");
 
-	printf("dump: ");
-	grass_dump_value_list(machine->dump);
+	printf("dump: (");
+	for(i = machine->dump_depth; i > 0; i--)
+	{
+		printf("[");
+		grass_dump_code(machine->program, machine->dump[i - 1].code);
+		printf(", ");
+		grass_dump_value_list(machine->program, machine->dump[i - 1].env);
+		printf("] :: ");
+	}
+	printf("ε)");
 	puts("");
 
 	puts("");
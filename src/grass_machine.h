@@ -11,23 +11,341 @@
 #ifndef grass_machine_H_
 #define grass_machine_H_
 
+#include <stddef.h>
 #include "grass_fwd.h"
+#include "grass_value.h"
+#include "grass_bytecode.h"
+
+/*!
+ * ネイティブコードに変換された命令列の入口。
+ *
+ * machine->env を環境として \a code の位置から実行し、抽象機械が実行を
+ * 再開する位置を返す。ネイティブコードで実行できない命令に当たった場合は、
+ * その命令の位置を返す。それがクロージャの適用 (App) なら、取り出した関数と
+ * 引数を machine->native_func, machine->native_arg に格納する。
+ * エラー時は GRASS_NATIVE_ERROR を返し、 machine->native_error_message に
+ * エラーを説明する文字列を格納する。
+ */
+typedef size_t (*grass_native_code)(struct grass_machine *machine, size_t code);
+
+/*! grass_native_code がエラーを返す時の値。 */
+#define GRASS_NATIVE_ERROR ((size_t)-1)
+
+/*!
+ * 入出力先。 Out と In プリミティブはこれを通して入出力を行う。
+ */
+struct grass_io
+{
+	/*! 1文字読み込む。 getchar() と同様、終端では EOF を返す。 */
+	int (*get_char)(void *context);
+	/*! 1文字出力する。 */
+	void (*put_char)(int c, void *context);
+	void *context;
+};
+
+/*! 標準入出力 (stdin, stdout) 。機械の作成時の入出力先。 */
+extern const struct grass_io grass_stdio;
+
+/*! 環境スタックのチャンクあたりのセル数 */
+#if defined(GRASS_REFCOUNT_HEAP)
+/* チャンクがアリーナのブロック (64KB) にちょうど収まる数 (セルは 24 バイト) */
+#define GRASS_ENV_CHUNK_CELLS 2729
+#elif defined(GRASS_COMPACT_HEAP)
+/* チャンクがアリーナのブロック (64KB) にちょうど収まる数 */
+#define GRASS_ENV_CHUNK_CELLS 3275
+#else
+#define GRASS_ENV_CHUNK_CELLS 1024
+#endif
+
+/*!
+ * 環境スタックのチャンク。
+ * セルのアドレスが変わらないように、スタックは固定長のチャンクを繋いで作る。
+ * 一度確保したチャンクは、スタックが縮んでも再利用のために残しておく。
+ */
+struct grass_env_chunk
+{
+	struct grass_env_chunk *prev;
+	struct grass_env_chunk *next;
+	size_t index; /*!< \brief 底から数えたチャンクの番号 */
+	struct grass_value_node cells[GRASS_ENV_CHUNK_CELLS];
+};
+
+/*!
+ * 環境スタック上の位置。
+ */
+struct grass_env_mark
+{
+	struct grass_env_chunk *chunk;
+	size_t used; /*!< \brief chunk 中の使用済みセル数 */
+};
+
+/*! \brief 環境スタック上の位置 \a mark の、底から数えたセル数。 */
+#define GRASS_ENV_MARK_DEPTH(mark) \
+	((mark).chunk->index * GRASS_ENV_CHUNK_CELLS + (mark).used)
+
+#if !defined(GRASS_COMPACT_HEAP)
+/*! クロージャスタックのチャンクあたりのクロージャ数 */
+#define GRASS_CLOSURE_CHUNK_CLOSURES 1024
+
+/*!
+ * クロージャスタックのチャンク。
+ * 環境スタックと同じく、アドレスが変わらないように固定長のチャンクを繋ぐ。
+ */
+struct grass_closure_chunk
+{
+	struct grass_closure_chunk *next;
+	struct grass_closure closures[GRASS_CLOSURE_CHUNK_CLOSURES];
+};
+
+/*!
+ * クロージャスタック上の位置。
+ */
+struct grass_closure_mark
+{
+	struct grass_closure_chunk *chunk;
+	size_t used; /*!< \brief chunk 中の使用済みクロージャ数 */
+};
+#endif
+
+
+/*! App の実行の仕方。 grass_resolve_application() 参照。 */
+enum grass_app_action
+{
+	GRASS_APP_PUSH,  /*!< \brief 結果の値が求まったので、それを積む */
+	GRASS_APP_CALL,  /*!< \brief 引数1個のクロージャの本体を呼ぶ */
+	GRASS_APP_APPLY  /*!< \brief 関数の種類を確かめて適用する (部分適用も含む) */
+};
+
+
+/*!
+ * Dump のフレーム。
+ * 関数から戻った後に実行を再開するコードと、その時の環境の組。
+ */
+struct grass_dump_frame
+{
+	size_t code;
+	struct grass_value_node *env;
+	struct grass_env_mark env_base; /*!< \brief 呼び出し元の env_base */
+#if !defined(GRASS_COMPACT_HEAP)
+	struct grass_closure_mark closure_base; /*!< \brief 呼び出し元の closure_base */
+#endif
+};
+
 
 struct grass_machine
 {
-	struct grass_instruction_node *code;
+	const struct grass_program *program;
+	const struct grass_io *io;
+	size_t code; /*!< \brief 次に実行する命令の、 program->ops 中の位置 */
 	struct grass_value_node *env;
-	struct grass_value_node *dump;
+
+	/*!
+	 * 環境スタック。
+	 * 関数適用やプリミティブの結果として環境に積まれるセルは、まずここに
+	 * 置かれ、クロージャに捕捉される時に初めてヒープへ移される。
+	 * 現在の関数呼び出しが積んだセルは env_base から env_top まで。
+	 */
+	struct grass_env_mark env_top;
+	struct grass_env_mark env_base;
+
+#if !defined(GRASS_COMPACT_HEAP)
+	/*!
+	 * クロージャスタック。エスケープしない App (grass_opcode の app.local)
+	 * が部分適用で作るクロージャを置き、その引数のセルは環境スタックに置く。
+	 * 現在の関数呼び出しが置いたものは closure_base から closure_top まで。
+	 * 環境スタックのセルと同じく、戻る時と末尾呼び出しの時に捨てる。
+	 * GRASS_COMPACT_HEAP では、部分適用はアリーナの若い世代に置けば
+	 * 安く回収されるので使わない。
+	 */
+	struct grass_closure_mark closure_top;
+	struct grass_closure_mark closure_base;
+	/*! クロージャスタックに置いた部分適用の数 (統計用) 。 */
+	size_t num_local_closures;
+#endif
+
+	/*!
+	 * Dump 。 Grass には継続を取り出す手段がなく、 Dump が共有されることは
+	 * ないので、機械が所有する伸長可能な配列で持つ。
+	 * dump[dump_depth - 1] が先頭。
+	 */
+	struct grass_dump_frame *dump;
+	size_t dump_depth;    /*!< \brief Dump に積まれているフレーム数 */
+	size_t dump_capacity; /*!< \brief dump の確保済みフレーム数 */
+
+	/*! 数値比較の結果として共有される true/false 。機械の作成時に一度だけ作られる。 */
+	grass_value true_value;
+	grass_value false_value; /*!< \brief true_value 参照 */
+
+	/*!
+	 * 命令ごとのネイティブコードの入口。要素数は program->num_ops 。
+	 * 使わない場合は NULL 。要素が NULL の命令は抽象機械が実行する。
+	 */
+	const grass_native_code *native_code;
+	char *native_error_message; /*!< \brief ネイティブコード中のエラーの説明 */
+	grass_value native_func; /*!< \brief grass_native_code 参照 */
+	grass_value native_arg;  /*!< \brief grass_native_code 参照 */
+
+	/*! 抽象の本体をネイティブコードに変換する JIT 。使わない場合は NULL 。 */
+	struct grass_jit *jit;
+
+#if defined(GRASS_COMPACT_HEAP)
+	/*! 値、環境のセル、クロージャを置くヒープ。 */
+	struct grass_arena *arena;
+
+	/*!
+	 * 前回の GC から書き換えられていない、環境スタックの底からのセル数と
+	 * Dump の底からのフレーム数。若い世代の GC では、これより上だけを
+	 * ルートとして走査する。 (grass_gc.h の GRASS_GC_NOTE_RETURN 参照)
+	 */
+	size_t gc_env_floor;
+	size_t gc_dump_floor; /*!< \brief gc_env_floor 参照 */
+#endif
 };
 
 
 /* 初期状態のGrass抽象機械を作成する。 */
 struct grass_machine *
-grass_create_machine(struct grass_instruction_node *code);
+grass_create_machine(const struct grass_program *program, char **error_message);
 
+/* ヒープの上限を指定して、初期状態のGrass抽象機械を作成する。 */
+struct grass_machine *
+grass_create_machine_with_heap_limit(const struct grass_program *program,
+                                     size_t heap_limit, char **error_message);
+
+/* JIT を使うようにする。 */
+void
+grass_attach_jit(struct grass_machine *machine, struct grass_jit *jit);
+
+/* 環境スタックにセルを積む。 */
+struct grass_value_node *
+grass_push_env_cell(struct grass_machine *machine,
+                    grass_value value,
+                    struct grass_value_node *env);
+
+#if defined(GRASS_REFCOUNT_HEAP)
+/* 環境スタック上の現在の呼び出しのセルを捨てる。 */
+void
+grass_drop_env_cells(struct grass_machine *machine);
+
+/*! \brief 現在の呼び出しが積んだセルを捨てる (env_top を env_base に戻す)。 */
+#define GRASS_DROP_ENV_CELLS(machine) grass_drop_env_cells(machine)
+#elif defined(GRASS_COMPACT_HEAP)
+#define GRASS_DROP_ENV_CELLS(machine) ((void)((machine)->env_top = (machine)->env_base))
+#else
+/* クロージャスタック上のものも一緒に捨てる */
+#define GRASS_DROP_ENV_CELLS(machine)                        \
+	((void)((machine)->env_top = (machine)->env_base,    \
+	        (machine)->closure_top = (machine)->closure_base))
+#endif
+
+/*!
+ * \brief 関数呼び出しの開始時に、呼び出し先が積むセルの置き場を分ける。
+ * 呼び出し元の env_base (と closure_base) は、先に Dump などに保存しておくこと。
+ */
+#if defined(GRASS_COMPACT_HEAP)
+#define GRASS_ENTER_CALL(machine) ((void)((machine)->env_base = (machine)->env_top))
+#else
+#define GRASS_ENTER_CALL(machine)                            \
+	((void)((machine)->env_base = (machine)->env_top,    \
+	        (machine)->closure_base = (machine)->closure_top))
+#endif
+
+#if !defined(GRASS_COMPACT_HEAP)
+/* エスケープしない部分適用を、クロージャスタックに作る。 */
+grass_value
+grass_create_local_partial_application(struct grass_machine *machine,
+                                       grass_value func, grass_value arg);
+#endif
+
+/*!
+ * 検証済みのプログラムで、 App \a op の実行の仕方を決める。
+ * 抽象機械 (grass_run_machine()) と評価器 (grass_eval_program()) で共有する。
+ *
+ * 関数が静的に分かっていれば (grass_opcode の app.callee 参照) 、
+ * プリミティブはその場で計算し、クロージャは種類を確かめずに呼ぶ。
+ * 何も捕捉しないクロージャは、関数を環境から取り出しもしない。
+ * 分からなくても、プリミティブの計算は値のタグだけで決まるので、
+ * 環境から取り出した関数がプリミティブならその場で計算する。
+ *
+ * \param env        App を実行する時の環境。
+ * \param arg        引数。
+ * \param func       GRASS_APP_APPLY と GRASS_APP_CALL の場合、適用する関数が
+ *                   格納される。何も捕捉しないクロージャなら GRASS_NO_VALUE 。
+ * \param value      GRASS_APP_PUSH の場合、積む値が格納される。
+ *                   (Out の出力は済んでいる)
+ * \param callee     GRASS_APP_CALL の場合、本体の位置が格納される。
+ * \param callee_env GRASS_APP_CALL の場合、本体を実行する環境が格納される。
+ */
+static inline enum grass_app_action
+grass_resolve_application(struct grass_machine *machine,
+                          const struct grass_opcode *op,
+                          struct grass_value_node *env, grass_value arg,
+                          grass_value *func, grass_value *value,
+                          size_t *callee, struct grass_value_node **callee_env)
+{
+	grass_value primitive;
+
+	switch(op->content.app.callee)
+	{
+	case GRASS_CALLEE_COMBINATOR:
+		*func = GRASS_NO_VALUE;
+		*callee = op->content.app.callee_code;
+		*callee_env = NULL;
+		return GRASS_APP_CALL;
+
+	case GRASS_CALLEE_CLOSURE:
+		*func = grass_get_verified_value_node(env, op->content.app.func_index)->value;
+		*callee = op->content.app.callee_code;
+		*callee_env = GRASS_NODE_PTR(GRASS_CLOSURE(*func)->env);
+		return GRASS_APP_CALL;
+
+	case GRASS_CALLEE_OUT:
+		primitive = GRASS_OUT_VALUE;
+		break;
+
+	case GRASS_CALLEE_IN:
+		primitive = GRASS_IN_VALUE;
+		break;
+
+	case GRASS_CALLEE_SUCC:
+		primitive = GRASS_SUCC_VALUE;
+		break;
+
+	case GRASS_CALLEE_NUMERIC:
+		primitive = GRASS_NUMERIC_VALUE(op->content.app.callee_code);
+		break;
+
+	default:
+		*func = grass_get_verified_value_node(env, op->content.app.func_index)->value;
+		if(GRASS_IS_CLOSURE(*func))
+		{
+			return GRASS_APP_APPLY;
+		}
+		primitive = *func;
+		break;
+	}
+
+	/* In と、エラーになる適用は grass_apply_primitive() に任せる。 */
+	*value = GRASS_PRIMITIVE_RESULT(primitive, arg, machine->io,
+	                                machine->true_value, machine->false_value);
+	if(*value == GRASS_NO_VALUE)
+	{
+		*func = primitive;
+		return GRASS_APP_APPLY;
+	}
+
+	return GRASS_APP_PUSH;
+}
+
+/* 1ステップだけ実行する。デバッグ (trace, step) 用。 */
 int
 grass_step_machine(struct grass_machine *machine, char **error_message);
 
+/* 終了するか、 max_steps ステップに達するまで実行する。 */
+int
+grass_run_machine(struct grass_machine *machine, size_t max_steps,
+                  size_t *num_steps, char **error_message);
+
 int
 grass_machine_done(const struct grass_machine *machine);
 
@@ -15,6 +15,7 @@
 #include <string.h>
 #include <gc.h>
 #include <errno.h>
+#include <stdio.h>
 
 #include "static_assert.h"
 #include <assert.h>
@@ -39,6 +40,7 @@ struct grass_token
 	 */
 	wint_t type;
 	size_t n; /*!< 'W'または'w'がいくつ連続しているか。 type がそれ以外なら意味を持たない。 */
+	size_t line; /*!< トークンの先頭の行番号 (1始まり)。 */
 };
 
 
@@ -226,6 +228,7 @@ grass_read_token(FILE *in, struct grass_read_context *context, struct grass_toke
 	assert(token != NULL);
 
 	token->type = grass_get_sourcewc(in, context);
+	token->line = context->read_lines + 1;
 	switch(token->type)
 	{
 	case L'W':
@@ -291,9 +294,63 @@ grass_skip_until_first_w(FILE *in, struct grass_read_context *context)
 }
 
 
+/*!
+ * App(\a function_index, \a arg_index) が、要素数 \a depth の環境の範囲内を
+ * 指すか確かめる。
+ *
+ * 環境の要素数は実行前に決まる。トップレベルでは初期環境に命令ひとつごとに
+ * 1 ずつ積まれ、 Abs(k, C') の本体 C' は、その Abs の位置の環境に引数 k 個を
+ * 積んだところから始まる。範囲外を指す App は、実行されるかどうかに関わらず
+ * 読み込み時のエラーにする。そのため、実行時には範囲の確認が要らない
+ * (grass_compile_program() 参照) 。
+ *
+ * \param line App の位置 (エラーメッセージ用の行番号)。
+ *
+ * \retval zero     範囲外。 \a error_message に行番号付きの説明が格納される。
+ * \retval non-zero 範囲内。
+ */
+static int
+grass_check_application(size_t line,
+                        size_t function_index, size_t arg_index, size_t depth,
+                        char **error_message)
+{
+	static const char format[] =
+		"parse error: line %zu: App(%zu, %zu) refers beyond the %zu values in its environment.";
+	size_t length;
+	char *message;
+
+	if((function_index <= depth) && (arg_index <= depth))
+	{
+		return 1;
+	}
+
+	length = snprintf(NULL, 0, format, line,
+	                  function_index, arg_index, depth) + 1;
+	message = (char *)GC_MALLOC_ATOMIC(length);
+	if(message == NULL)
+	{
+		*error_message = "parse error: index out of range.";
+		return 0;
+	}
+	snprintf(message, length, format, line,
+	         function_index, arg_index, depth);
+	*error_message = message;
+
+	return 0;
+}
+
+
+/*!
+ * App を読み込む。
+ *
+ * \param function_index 読み込み済みの、関数の位置を表すトークンの値。
+ * \param line           そのトークンの行番号。 App の位置として報告する。
+ * \param depth          この App を実行する時の環境の要素数。
+ */
 static struct grass_instruction_node *
 grass_parse_application(FILE *in, struct grass_read_context *context,
-                        size_t function_index, char **error_message)
+                        size_t function_index, size_t line, size_t depth,
+                        char **error_message)
 {
 	struct grass_instruction_node *app;
 	struct grass_token token;
@@ -313,6 +370,10 @@ grass_parse_application(FILE *in, struct grass_read_context *context,
 		*error_message = "parse error: unexpected character.";
 		return NULL;
 	}
+	if(!grass_check_application(line, function_index, token.n, depth, error_message))
+	{
+		return NULL;
+	}
 
 	app = grass_create_application_node(function_index, token.n);
 	if(app == NULL)
@@ -325,9 +386,14 @@ grass_parse_application(FILE *in, struct grass_read_context *context,
 }
 
 
+/*!
+ * Abs を読み込む。
+ *
+ * \param depth この Abs を実行する時の環境の要素数。
+ */
 static struct grass_instruction_node *
 grass_parse_abstraction(FILE *in, struct grass_read_context *context,
-                        size_t num_args, char **error_message)
+                        size_t num_args, size_t depth, char **error_message)
 {
 	struct grass_instruction_node *abs;
 	struct grass_instruction_node *body = NULL;
@@ -338,6 +404,7 @@ grass_parse_abstraction(FILE *in, struct grass_read_context *context,
 	assert(context != NULL);
 	assert(error_message != NULL);
 
+	depth += num_args; /* 本体は引数を積んだところから始まる */
 	while(!done)
 	{
 		struct grass_instruction_node *app;
@@ -351,12 +418,14 @@ grass_parse_abstraction(FILE *in, struct grass_read_context *context,
 		switch(token.type)
 		{
 		case L'W':
-			app = grass_parse_application(in, context, token.n, error_message);
+			app = grass_parse_application(in, context, token.n, token.line, depth,
+			                              error_message);
 			if(app == NULL)
 			{
 				return NULL;
 			}
 			body = grass_append_instruction_list(body, app);
+			depth++;
 			break;
 
 		default:
@@ -408,6 +477,7 @@ grass_parse_source(FILE *in, char **error_message)
 {
 	struct grass_read_context context;
 	struct grass_instruction_node *code = NULL;
+	size_t depth = GRASS_INITIAL_ENV_DEPTH; /* 次の命令を実行する時の環境の要素数 */
 	char *dummy_error_message;
 
 	grass_init_read_context(&context);
@@ -440,11 +510,12 @@ grass_parse_source(FILE *in, char **error_message)
 		switch(token.type)
 		{
 		case L'W':
-			node = grass_parse_application(in, &context, token.n, error_message);
+			node = grass_parse_application(in, &context, token.n, token.line, depth,
+			                               error_message);
 			break;
 
 		case L'w':
-			node = grass_parse_abstraction(in, &context, token.n, error_message);
+			node = grass_parse_abstraction(in, &context, token.n, depth, error_message);
 			break;
 
 		case WEOF:
@@ -465,6 +536,7 @@ grass_parse_source(FILE *in, char **error_message)
 		}
 
 		code = grass_append_instruction_list(code, node);
+		depth++;
 	}
 
 	assert(0);
@@ -0,0 +1,414 @@
+/* $Id$ */
+/*! \file
+ * \brief grass --emit-c が出力した C プログラム用のランタイム。
+ *
+ * 環境スタックの扱いは grass_eval_program() と同じ。
+ *
+ * \date 2009-01-06
+ * \author yoh2
+ * $LastChangedBy$
+ * $LastChangedDate$
+ */
+
+#include "grass_runtime.h"
+#include "grass_boehm.h"
+#include "grass_gc.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+
+/*!
+ * ヒープに確保する命令の後で、必要なら GC を行う。 (grass_eval.c 参照)
+ *
+ * \retval zero     エラー発生。
+ * \retval non-zero 成功。
+ */
+static int
+grass_native_safe_point(struct grass_native_context *ctx, struct grass_value_node **env)
+{
+#if defined(GRASS_COMPACT_HEAP) && !defined(GRASS_REFCOUNT_HEAP)
+	struct grass_machine *machine = ctx->machine;
+
+	machine->env = *env;
+	if(!GRASS_GC_SAFE_POINT(machine, &ctx->error_message))
+	{
+		return 0;
+	}
+	*env = machine->env;
+#else
+	(void)ctx;
+	(void)env;
+#endif
+
+	return 1;
+}
+
+
+/*!
+ * 関数呼び出しを抽象機械に任せる。
+ * 抽象機械の Dump は空なので、呼び出した本体の RET で止まる。
+ *
+ * \return 呼び出しの結果。エラー時は GRASS_NO_VALUE 。
+ */
+static grass_value
+grass_native_on_machine(struct grass_native_context *ctx, size_t code,
+                        struct grass_value_node *env)
+{
+	struct grass_machine *machine = ctx->machine;
+
+	assert(machine->dump_depth == 0);
+
+	machine->code = code;
+	machine->env = env;
+	if(!grass_run_machine(machine, 0, NULL, &ctx->error_message))
+	{
+		return GRASS_NO_VALUE;
+	}
+
+	return machine->env->value;
+}
+
+
+/*!
+ * 位置 \a code の Abs を実行し、作ったクロージャを \a env に積む。
+ *
+ * \param captures 捕捉する値の表の位置 (grass_opcode の abs.captures) 。
+ *
+ * \return 新しい環境。エラー時は NULL 。
+ */
+struct grass_value_node *
+grass_native_abstraction(struct grass_native_context *ctx,
+                         struct grass_value_node *env, size_t code,
+                         size_t num_args, size_t captures)
+{
+	struct grass_machine *machine = ctx->machine;
+	const size_t *indices = &machine->program->captures[captures];
+	grass_value closure;
+
+	closure = grass_create_flat_closure(code + 1, num_args, env,
+	                                    indices + 1, indices[0]);
+	if(closure == GRASS_NO_VALUE)
+	{
+		goto memory_error;
+	}
+	env = grass_push_env_cell(machine, closure, env);
+	if(env == NULL)
+	{
+		goto memory_error;
+	}
+	if(!grass_native_safe_point(ctx, &env))
+	{
+		return NULL;
+	}
+
+	return env;
+
+memory_error:
+	ctx->error_message = GRASS_HEAP_ERROR_MESSAGE();
+	return NULL;
+}
+
+
+/*!
+ * 関数 \a func を \a arg に適用し、結果を \a env に積む。
+ *
+ * \param local grass_opcode の app.local 。
+ *
+ * \return 新しい環境。エラー時は NULL 。
+ */
+struct grass_value_node *
+grass_native_apply(struct grass_native_context *ctx,
+                   struct grass_value_node *env, size_t depth, int local,
+                   grass_value func, grass_value arg)
+{
+	struct grass_machine *machine = ctx->machine;
+	grass_value closure;
+
+	if(!GRASS_IS_CLOSURE(func))
+	{
+		machine->env = env;
+		if(!grass_apply_primitive(machine, func, arg, &ctx->error_message))
+		{
+			return NULL;
+		}
+		return machine->env;
+	}
+
+	if(GRASS_CLOSURE(func)->num_args == 1)
+	{
+		return grass_native_call(ctx, env, depth, GRASS_CLOSURE(func)->code,
+		                         ctx->bodies[GRASS_CLOSURE(func)->code], func,
+		                         GRASS_NODE_PTR(GRASS_CLOSURE(func)->env), arg);
+	}
+
+	/* 部分適用。 grass_run_machine() 参照。 */
+#if !defined(GRASS_COMPACT_HEAP)
+	if(local)
+	{
+		closure = grass_create_local_partial_application(machine, func, arg);
+	}
+	else
+#else
+	(void)local;
+#endif
+	{
+		closure = grass_create_partial_application(func, arg);
+	}
+	if(closure == GRASS_NO_VALUE)
+	{
+		goto memory_error;
+	}
+	env = grass_push_env_cell(machine, closure, env);
+	if(env == NULL)
+	{
+		goto memory_error;
+	}
+	if(!grass_native_safe_point(ctx, &env))
+	{
+		return NULL;
+	}
+
+	return env;
+
+memory_error:
+	ctx->error_message = GRASS_HEAP_ERROR_MESSAGE();
+	return NULL;
+}
+
+
+/*!
+ * 本体の最後の App を実行する。
+ * 関数が1引数のクロージャなら末尾呼び出しになる。
+ *
+ * \return 本体の関数が返す値 (grass_native_body 参照) 。
+ */
+grass_value
+grass_native_tail_apply(struct grass_native_context *ctx,
+                        struct grass_value_node *env, size_t depth, int local,
+                        grass_value func, grass_value arg)
+{
+	if((func != GRASS_NO_VALUE) && (arg != GRASS_NO_VALUE)
+	&& GRASS_IS_CLOSURE(func) && (GRASS_CLOSURE(func)->num_args == 1))
+	{
+		return grass_native_tail_call(ctx, ctx->bodies[GRASS_CLOSURE(func)->code],
+		                              func, GRASS_NODE_PTR(GRASS_CLOSURE(func)->env),
+		                              arg);
+	}
+
+	env = grass_native_apply(ctx, env, depth, local, func, arg);
+	if(env == NULL)
+	{
+		return GRASS_NO_VALUE;
+	}
+
+	return env->value;
+}
+
+
+/*!
+ * 本体 \a body (位置 \a code) の1引数のクロージャ \a func を \a arg に
+ * 適用し、結果を \a env に積む。
+ *
+ * 呼び出し元の env_base は C のローカル変数に保存する。
+ *
+ * \param func       クロージャ。何も捕捉しないクロージャなら GRASS_NO_VALUE 。
+ * \param callee_env 本体を実行する環境 (クロージャの環境) 。
+ *
+ * \return 新しい環境。エラー時は NULL 。
+ */
+struct grass_value_node *
+grass_native_call(struct grass_native_context *ctx,
+                  struct grass_value_node *env, size_t depth,
+                  size_t code, grass_native_body body,
+                  grass_value func, struct grass_value_node *callee_env,
+                  grass_value arg)
+{
+	struct grass_machine *machine = ctx->machine;
+	struct grass_env_mark saved_base = machine->env_base;
+#if !defined(GRASS_COMPACT_HEAP)
+	struct grass_closure_mark saved_closure_base = machine->closure_base;
+#endif
+	grass_value result;
+
+	(void)func;
+
+	GRASS_ENTER_CALL(machine);
+	callee_env = grass_push_env_cell(machine, arg, callee_env);
+	if(callee_env == NULL)
+	{
+		goto memory_error;
+	}
+
+	if(depth < GRASS_NATIVE_MAX_DEPTH)
+	{
+		result = grass_native_run(ctx, body, callee_env, depth + 1);
+	}
+	else
+	{
+		result = grass_native_on_machine(ctx, code, callee_env);
+	}
+	if(result == GRASS_NO_VALUE)
+	{
+		return NULL;
+	}
+
+	/* 戻る */
+	GRASS_RC_RETAIN_VALUE(result);
+	GRASS_DROP_ENV_CELLS(machine);
+	machine->env_base = saved_base;
+#if !defined(GRASS_COMPACT_HEAP)
+	machine->closure_base = saved_closure_base;
+#endif
+	GRASS_GC_NOTE_RETURN(machine);
+	env = grass_push_env_cell(machine, result, env);
+	GRASS_RC_RELEASE_VALUE(result);
+	if(env == NULL)
+	{
+		goto memory_error;
+	}
+
+	return env;
+
+memory_error:
+	ctx->error_message = GRASS_HEAP_ERROR_MESSAGE();
+	return NULL;
+}
+
+
+/*!
+ * 本体 \a body の1引数のクロージャ \a func を、 \a arg に末尾呼び出しで適用する。
+ *
+ * 現在の呼び出しのセルを捨てて呼び出し先の環境を作り、実際の呼び出しは
+ * grass_native_run() に任せる。
+ *
+ * \return 本体の関数が返す値 (grass_native_body 参照) 。
+ */
+grass_value
+grass_native_tail_call(struct grass_native_context *ctx, grass_native_body body,
+                       grass_value func, struct grass_value_node *callee_env,
+                       grass_value arg)
+{
+	struct grass_machine *machine = ctx->machine;
+
+	(void)func;
+
+	GRASS_RC_RETAIN_VALUE(func);
+	GRASS_RC_RETAIN_VALUE(arg);
+	GRASS_DROP_ENV_CELLS(machine);
+	callee_env = grass_push_env_cell(machine, arg, callee_env);
+	GRASS_RC_RELEASE_VALUE(arg);
+	GRASS_RC_RELEASE_VALUE(func);
+	if(callee_env == NULL)
+	{
+		ctx->error_message = GRASS_HEAP_ERROR_MESSAGE();
+		return GRASS_NO_VALUE;
+	}
+
+	ctx->tail_body = body;
+	ctx->tail_env = callee_env;
+	return GRASS_NO_VALUE;
+}
+
+
+/*!
+ * 本体 \a body を環境 \a env で実行する。末尾呼び出しはここでループする。
+ *
+ * \return 本体の評価結果。エラー時は GRASS_NO_VALUE 。
+ */
+grass_value
+grass_native_run(struct grass_native_context *ctx, grass_native_body body,
+                 struct grass_value_node *env, size_t depth)
+{
+	grass_value result;
+
+	for(;;)
+	{
+		result = body(ctx, env, depth);
+		if((result != GRASS_NO_VALUE) || (ctx->tail_body == NULL))
+		{
+			return result;
+		}
+		body = ctx->tail_body;
+		env = ctx->tail_env;
+		ctx->tail_body = NULL;
+	}
+}
+
+
+/*!
+ * コンパイル済みのプログラムを最後まで実行する。
+ *
+ * grass_eval_program() と同じく、本体の評価結果 f に対して
+ * main_call を f::ε で実行する。
+ * エラー時の出力は grass コマンドで実行した場合と同じ。
+ * Boehm GC の設定は grass コマンドと同じ GRASS_GC_* 環境変数から読む。
+ *
+ * \param program プログラム。
+ * \param bodies  本体の位置から、その本体の関数を引く表。
+ *
+ * \return そのまま main() の戻り値になる。
+ */
+int
+grass_run_native_program(const struct grass_program *program,
+                         const grass_native_body *bodies)
+{
+	struct grass_gc_options gc;
+	struct grass_native_context ctx;
+	struct grass_machine *machine;
+	struct grass_value_node *env;
+	grass_value result;
+	char *msg;
+
+	assert(program != NULL);
+	assert(bodies != NULL);
+
+	memset(&gc, 0, sizeof(gc));
+	if(!grass_get_gc_environment(&gc))
+	{
+		fprintf(stderr, "invalid GRASS_GC_* environment variable.\n");
+		return 1;
+	}
+	grass_init_gc(&gc);
+
+	machine = grass_create_machine(program, &msg);
+	if(machine == NULL)
+	{
+		printf("%s\n", msg);
+		return 1;
+	}
+	machine->dump_depth = 0; /* 初期 Dump は使わない */
+
+	ctx.machine = machine;
+	ctx.bodies = bodies;
+	ctx.tail_body = NULL;
+	ctx.tail_env = NULL;
+	ctx.error_message = NULL;
+
+	result = grass_native_run(&ctx, bodies[program->entry], machine->env, 0);
+	if(result != GRASS_NO_VALUE)
+	{
+		/* (App(1, 1)::ε, ε) に戻る */
+		GRASS_RC_RETAIN_VALUE(result);
+		GRASS_DROP_ENV_CELLS(machine);
+		env = grass_push_env_cell(machine, result, NULL);
+		GRASS_RC_RELEASE_VALUE(result);
+		if(env == NULL)
+		{
+			ctx.error_message = GRASS_HEAP_ERROR_MESSAGE();
+			result = GRASS_NO_VALUE;
+		}
+		else
+		{
+			result = grass_native_run(&ctx, bodies[program->main_call], env, 0);
+		}
+	}
+	if(result == GRASS_NO_VALUE)
+	{
+		printf("%s\n", ctx.error_message);
+		return 1;
+	}
+
+	return 0;
+}
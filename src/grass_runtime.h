@@ -0,0 +1,213 @@
+/* $Id$ */
+/*! \file
+ * \brief grass --emit-c が出力した C プログラム用のランタイム。
+ *
+ * 出力されたプログラムは、このヘッダをインクルードし、
+ * libgrassrt (値の表現、プリミティブ、抽象機械) と libgc にリンクする。
+ *
+ * \code
+ * grass --emit-c foo.grass > foo.c
+ * cc -I$(includedir)/grass foo.c -lgrassrt -lgc
+ * \endcode
+ *
+ * 抽象の本体はそれぞれ grass_native_body 型の C 関数になり、
+ * 関数呼び出しは本体の関数の直接の呼び出しになる (grass_eval_program() と
+ * 同じく、戻り先は C のスタックに置く)。末尾呼び出しは再帰せず、
+ * 呼び出し元の grass_native_run() のループで次の本体を呼ぶ。
+ * 再帰が GRASS_NATIVE_MAX_DEPTH を越えると、それより深い呼び出しは
+ * 抽象機械で実行する。
+ *
+ * \date 2009-01-06
+ * \author yoh2
+ * $LastChangedBy$
+ * $LastChangedDate$
+ */
+#ifndef grass_runtime_H_
+#define grass_runtime_H_
+
+#include <stddef.h>
+#include "grass_fwd.h"
+#include "grass_bytecode.h"
+#include "grass_value.h"
+#include "grass_machine.h"
+#include "grass_arena.h"
+
+/*! C のスタック上で再帰する最大の深さ。 (GRASS_EVAL_MAX_DEPTH と同じ) */
+#define GRASS_NATIVE_MAX_DEPTH 10000
+
+struct grass_native_context;
+
+/*!
+ * コンパイル済みの抽象の本体。
+ *
+ * 環境 \a env で本体を実行し、 RET に達した時の環境の先頭を返す。
+ * 末尾呼び出しでは ctx->tail_body と ctx->tail_env を設定して
+ * GRASS_NO_VALUE を返す。エラー時は ctx->error_message を設定して
+ * GRASS_NO_VALUE を返す。
+ *
+ * \param depth 再帰の深さ。
+ */
+typedef grass_value (*grass_native_body)(struct grass_native_context *ctx,
+                                         struct grass_value_node *env,
+                                         size_t depth);
+
+/*! コンパイル済みのプログラムの実行中の状態。 */
+struct grass_native_context
+{
+	struct grass_machine *machine;
+	const grass_native_body *bodies; /*!< \brief 本体の位置から、その関数を引く表 */
+	grass_native_body tail_body;      /*!< \brief 末尾呼び出しの呼び出し先 */
+	struct grass_value_node *tail_env; /*!< \brief 末尾呼び出しの環境 */
+	char *error_message;
+};
+
+/*!
+ * 環境 env の n 番目の値。 n が定数なら、1番目と2番目はフィールドを直接読む。
+ */
+#define GRASS_NATIVE_VALUE(env, n)                                                     \
+	(((n) == 1)? (env)->value:                                                     \
+	 ((n) == 2)? GRASS_NODE_PTR(((env)->size == 1)? (env)->rest: (env)->left)->value: \
+	 grass_get_verified_value_node((env), (n))->value)
+
+/*!
+ * 位置 \a code の Abs を実行する。
+ * \a captures は捕捉する値の表 (grass_program::captures の位置) 。
+ */
+#define GRASS_NATIVE_ABS(ctx, env, code, num_args, captures)                     \
+	do                                                                       \
+	{                                                                        \
+		(env) = grass_native_abstraction((ctx), (env), (code), (num_args), \
+		                                 (captures));                    \
+		if((env) == NULL)                                                \
+		{                                                                \
+			return GRASS_NO_VALUE;                                   \
+		}                                                                \
+	}while(0)
+
+/*!
+ * 関数が静的に分からない App を実行する。
+ * \a local は grass_opcode の app.local 。
+ */
+#define GRASS_NATIVE_APP(ctx, env, depth, local, func, arg)                     \
+	do                                                                      \
+	{                                                                       \
+		(env) = grass_native_apply((ctx), (env), (depth), (local),      \
+		                           (func), (arg));                      \
+		if((env) == NULL)                                               \
+		{                                                               \
+			return GRASS_NO_VALUE;                                  \
+		}                                                               \
+	}while(0)
+
+/*!
+ * 関数がプリミティブ \a func と分かっている App を実行する。
+ * (grass_opcode の app.callee 参照)
+ *
+ * 関数を環境から取り出さず、クロージャかどうかも確かめない。
+ * \a func は定数なので、 GRASS_PRIMITIVE_RESULT() の種類の分岐は畳み込まれる。
+ */
+#define GRASS_NATIVE_PRIMITIVE_APP(ctx, env, depth, func, arg)                  \
+	do                                                                      \
+	{                                                                       \
+		struct grass_machine *machine_ = (ctx)->machine;                \
+		struct grass_value_node *env_;                                  \
+		grass_value arg_ = (arg);                                       \
+		grass_value value_;                                             \
+	                                                                        \
+		value_ = GRASS_PRIMITIVE_RESULT((func), arg_, machine_->io,     \
+		                                machine_->true_value,           \
+		                                machine_->false_value);         \
+		if(value_ == GRASS_NO_VALUE)                                    \
+		{                                                               \
+			GRASS_NATIVE_APP((ctx), (env), (depth), 0, (func), arg_); \
+			break;                                                  \
+		}                                                               \
+		env_ = grass_push_env_cell(machine_, value_, (env));            \
+		if(env_ == NULL)                                                \
+		{                                                               \
+			(ctx)->error_message = GRASS_HEAP_ERROR_MESSAGE();      \
+			return GRASS_NO_VALUE;                                  \
+		}                                                               \
+		(env) = env_;                                                   \
+	}while(0)
+
+/*!
+ * 関数が本体 \a body (位置 \a code) の1引数のクロージャと分かっている
+ * App を実行する。 \a func が GRASS_NO_VALUE なら何も捕捉しないクロージャ。
+ */
+#define GRASS_NATIVE_CALL(ctx, env, depth, code, body, func, arg)               \
+	do                                                                      \
+	{                                                                       \
+		grass_value func_ = (func);                                     \
+	                                                                        \
+		(env) = grass_native_call((ctx), (env), (depth), (code), (body), \
+		                          func_,                                \
+		                          (func_ == GRASS_NO_VALUE)? NULL:      \
+		                          GRASS_NODE_PTR(GRASS_CLOSURE(func_)->env), \
+		                          (arg));                               \
+		if((env) == NULL)                                               \
+		{                                                               \
+			return GRASS_NO_VALUE;                                  \
+		}                                                               \
+	}while(0)
+
+/*! GRASS_NATIVE_CALL() の末尾呼び出し版。本体の関数から return する。 */
+#define GRASS_NATIVE_TAIL_CALL(ctx, body, func, arg)                            \
+	do                                                                      \
+	{                                                                       \
+		grass_value func_ = (func);                                     \
+	                                                                        \
+		return grass_native_tail_call((ctx), (body), func_,             \
+		                              (func_ == GRASS_NO_VALUE)? NULL:  \
+		                              GRASS_NODE_PTR(GRASS_CLOSURE(func_)->env), \
+		                              (arg));                           \
+	}while(0)
+
+/*! GRASS_NATIVE_APP() の末尾呼び出し版。本体の関数から return する。 */
+#define GRASS_NATIVE_TAIL_APP(ctx, env, depth, local, func, arg)                \
+	return grass_native_tail_apply((ctx), (env), (depth), (local), (func), (arg))
+
+
+/* Abs を実行する。 */
+struct grass_value_node *
+grass_native_abstraction(struct grass_native_context *ctx,
+                         struct grass_value_node *env, size_t code,
+                         size_t num_args, size_t captures);
+
+/* App を実行する。 */
+struct grass_value_node *
+grass_native_apply(struct grass_native_context *ctx,
+                   struct grass_value_node *env, size_t depth, int local,
+                   grass_value func, grass_value arg);
+
+/* 末尾の App を実行する。 */
+grass_value
+grass_native_tail_apply(struct grass_native_context *ctx,
+                        struct grass_value_node *env, size_t depth, int local,
+                        grass_value func, grass_value arg);
+
+/* 1引数のクロージャを呼び出す。 */
+struct grass_value_node *
+grass_native_call(struct grass_native_context *ctx,
+                  struct grass_value_node *env, size_t depth,
+                  size_t code, grass_native_body body,
+                  grass_value func, struct grass_value_node *callee_env,
+                  grass_value arg);
+
+/* 1引数のクロージャを末尾呼び出しする。 */
+grass_value
+grass_native_tail_call(struct grass_native_context *ctx, grass_native_body body,
+                       grass_value func, struct grass_value_node *callee_env,
+                       grass_value arg);
+
+/* 本体を、末尾呼び出しを含めて実行する。 */
+grass_value
+grass_native_run(struct grass_native_context *ctx, grass_native_body body,
+                 struct grass_value_node *env, size_t depth);
+
+/* コンパイル済みのプログラムを実行する。 */
+int
+grass_run_native_program(const struct grass_program *program,
+                         const grass_native_body *bodies);
+
+#endif /* grass_runtime_H_ */
@@ -9,126 +9,174 @@
  */
 
 #include "grass_value.h"
-#include "grass_instruction.h"
+#include "grass_bytecode.h"
 #include "grass_machine.h"
+#include "grass_arena.h"
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
-#include <gc.h>
 #include <assert.h>
 
 
+/*!
+ * ノードを、要素数1のリストとして初期化する。
+ */
+static void
+grass_init_value_links(struct grass_value_node *node)
+{
+	node->left = GRASS_NO_NODE;
+	node->right = GRASS_NO_NODE;
+	node->rest = GRASS_NO_NODE;
+	node->size = 1;
+}
+
+
+/*!
+ * \a value を持つノードを作成する。
+ *
+ * \return 作成したノード。失敗時は NULL 。
+ */
 struct grass_value_node *
-grass_create_value_node(const struct grass_value *value)
+grass_create_value_node(grass_value value)
 {
 	struct grass_value_node *new_node;
 
-	assert(value != NULL);
-
-	new_node = (struct grass_value_node *)GC_MALLOC(sizeof(new_node[0]));
+	new_node = GRASS_ALLOC_NODE();
 	if(new_node == NULL)
 	{
 		return NULL;
 	}
 
-	new_node->value = *value;
-	new_node->next = NULL;
+	new_node->value = value;
+	GRASS_RC_RETAIN_VALUE(value);
+	grass_init_value_links(new_node);
 
 	return new_node;
 }
 
 
-struct grass_value_node *
-grass_create_closure_node(struct grass_instruction_node *code, struct grass_value_node *env)
+/*!
+ * クロージャの値を作成する。
+ * クロージャ本体だけをヒープに確保し、そのアドレスを値とする。
+ *
+ * \param env クロージャの環境。ヒープ上のものであること。
+ *
+ * \return 作成した値。失敗時は GRASS_NO_VALUE 。
+ */
+grass_value
+grass_create_closure_value(size_t code, size_t num_args, struct grass_value_node *env)
 {
-	struct grass_value_node *new_node
-		= (struct grass_value_node *)GC_MALLOC(sizeof(new_node[0]));
-	if(new_node == NULL)
+	struct grass_closure *new_closure = GRASS_ALLOC_CLOSURE();
+	if(new_closure == NULL)
 	{
-		return NULL;
+		return GRASS_NO_VALUE;
 	}
 
-	new_node->value.type = GRASS_VT_CLOSURE;
-	new_node->value.content.closure.code = code;
-	new_node->value.content.closure.env = env;
-	new_node->next = NULL;
+	/* ヒープ上のオブジェクトは少なくとも 8 バイト境界にあるので、タグは 0 になる。 */
+	assert(GRASS_IS_CLOSURE(GRASS_CLOSURE_VALUE(new_closure)));
 
-	return new_node;
+	new_closure->code = code;
+	new_closure->num_args = num_args;
+	new_closure->env = GRASS_NODE_REF(env);
+	GRASS_RC_RETAIN_NODE(env);
+
+	return GRASS_CLOSURE_VALUE(new_closure);
 }
 
-struct grass_value_node *
-grass_create_out_func_node(void)
+
+/*!
+ * クロージャ \a func を \a arg に部分適用したクロージャを作成する。
+ * Abs(k-1, C')::ε を実行してすぐに戻るのと同じ結果になる。
+ * 作るクロージャが捕捉する環境なので、引数のセルはヒープに置く。
+ *
+ * \return 作成した値。失敗時は GRASS_NO_VALUE 。
+ */
+grass_value
+grass_create_partial_application(grass_value func, grass_value arg)
 {
-	struct grass_value_node *new_node
-		= (struct grass_value_node *)GC_MALLOC(sizeof(new_node[0]));
-	if(new_node == NULL)
+	struct grass_value_node *arg_cell;
+
+	assert(GRASS_IS_CLOSURE(func) && (GRASS_CLOSURE(func)->num_args > 1));
+
+	arg_cell = GRASS_ALLOC_NODE();
+	if(arg_cell == NULL)
 	{
-		return NULL;
+		return GRASS_NO_VALUE;
 	}
+	arg_cell->value = arg;
+	grass_cons_value_node(arg_cell, GRASS_NODE_PTR(GRASS_CLOSURE(func)->env));
+	GRASS_RC_RETAIN_CELL(arg_cell);
 
-	new_node->value.type = GRASS_VT_OUT;
-	new_node->next = NULL;
-
-	return new_node;
+	return grass_create_closure_value(GRASS_CLOSURE(func)->code,
+	                                  GRASS_CLOSURE(func)->num_args - 1,
+	                                  arg_cell);
 }
 
 
-struct grass_value_node *
-grass_create_in_func_node(void)
+/*!
+ * \a env の \a indices[0], \a indices[1], ... 番目の値だけをこの順に並べた
+ * 環境を持つクロージャを作成する (flat closure) 。
+ * 環境は新たにヒープに作るので、 \a env は環境スタック上のものでもよい。
+ *
+ * \param indices 捕捉する値の添字。すべて \a env の範囲内であること。
+ * \param count   \a indices の要素数。
+ *
+ * \return 作成した値。失敗時は GRASS_NO_VALUE 。
+ */
+grass_value
+grass_create_flat_closure(size_t code, size_t num_args, struct grass_value_node *env,
+                          const size_t *indices, size_t count)
 {
-	struct grass_value_node *new_node
-		= (struct grass_value_node *)GC_MALLOC(sizeof(new_node[0]));
-	if(new_node == NULL)
+	struct grass_value_node *closure_env = NULL;
+
+	while(count > 0)
 	{
-		return NULL;
+		struct grass_value_node *cell = GRASS_ALLOC_NODE();
+		if(cell == NULL)
+		{
+			return GRASS_NO_VALUE;
+		}
+		count--;
+		cell->value = grass_get_verified_value_node(env, indices[count])->value;
+		closure_env = grass_cons_value_node(cell, closure_env);
+		GRASS_RC_RETAIN_CELL(cell);
 	}
 
-	new_node->value.type = GRASS_VT_IN;
-	new_node->next = NULL;
+	return grass_create_closure_value(code, num_args, closure_env);
+}
 
-	return new_node;
+struct grass_value_node *
+grass_create_out_func_node(void)
+{
+	return grass_create_value_node(GRASS_OUT_VALUE);
 }
 
 
 struct grass_value_node *
-grass_create_succ_func_node(void)
+grass_create_in_func_node(void)
 {
-	struct grass_value_node *new_node
-		= (struct grass_value_node *)GC_MALLOC(sizeof(new_node[0]));
-	if(new_node == NULL)
-	{
-		return NULL;
-	}
+	return grass_create_value_node(GRASS_IN_VALUE);
+}
 
-	new_node->value.type = GRASS_VT_SUCC;
-	new_node->next = NULL;
 
-	return new_node;
+struct grass_value_node *
+grass_create_succ_func_node(void)
+{
+	return grass_create_value_node(GRASS_SUCC_VALUE);
 }
 
 
 struct grass_value_node *
 grass_create_numeric_node(int n)
 {
-	struct grass_value_node *new_node
-		= (struct grass_value_node *)GC_MALLOC(sizeof(new_node[0]));
-	if(new_node == NULL)
-	{
-		return NULL;
-	}
-
 	assert((0 <= n) && (n <= 255));
 
-	new_node->value.type = GRASS_VT_NUMERIC;
-	new_node->value.content.numeric.n = n;
-	new_node->next = NULL;
-
-	return new_node;
+	return grass_create_value_node(GRASS_NUMERIC_VALUE(n));
 }
 
 
-static struct grass_value_node *
-grass_create_true_node(void)
+grass_value
+grass_create_true_value(const struct grass_program *program)
 {
 	/*
 	 * 関数
@@ -147,34 +195,27 @@ grass_create_true_node(void)
 	 * (Abs(1, App(3, 2)::ε), (ε, ε)::ε)
 	 *
 	 * を作成する。
+	 * 本体はコンパイル時に program->true_code に用意されている。
 	 */
-	struct grass_instruction_node *abs_code;
-	struct grass_instruction_node *true_code;
+	grass_value identity;
 	struct grass_value_node *env_node;
 
-	abs_code = grass_create_application_node(3, 2);
-	if(abs_code == NULL)
+	identity = grass_create_closure_value(program->empty, 1, NULL);
+	if(identity == GRASS_NO_VALUE)
 	{
-		return NULL;
-	}
-
-	true_code = grass_create_abstraction_node(1, abs_code);
-	if(true_code == NULL)
-	{
-		return NULL;
+		return GRASS_NO_VALUE;
 	}
-
-	env_node = grass_create_closure_node(NULL, NULL);
+	env_node = grass_create_value_node(identity);
 	if(env_node == NULL)
 	{
-		return NULL;
+		return GRASS_NO_VALUE;
 	}
 
-	return grass_create_closure_node(true_code, env_node);
+	return grass_create_closure_value(program->true_code, 2, env_node);
 }
 
-static struct grass_value_node *
-grass_create_false_node(void)
+grass_value
+grass_create_false_value(const struct grass_program *program)
 {
 	/*
 	 * 関数
@@ -186,128 +227,197 @@ grass_create_false_node(void)
 	 * (Abs(1, ε)::ε, ε)
 	 *
 	 * を作成する。
+	 * 本体はコンパイル時に program->false_code に用意されている。
 	 */
-	struct grass_instruction_node *false_code = NULL;
-
-	false_code = grass_create_abstraction_node(1, NULL);
-	if(false_code == NULL)
-	{
-		return NULL;
-	}
-
-	return grass_create_closure_node(false_code, NULL);
+	return grass_create_closure_value(program->false_code, 2, NULL);
 }
 
+/*!
+ * \a node を \a list の先頭に繋ぐ。
+ *
+ * \a list の先頭2つの木のサイズが等しければ、 \a node を根として
+ * それらをひとつの木にまとめる。そうでなければ \a node 単独の木を
+ * 先頭に追加する。
+ * \a list のノードは変更しないので、 \a list は引き続き使用できる。
+ *
+ * \param node 繋ぐノード。まだリストに繋がれていないものであること。
+ * \param list 繋ぐ先のリスト。 NULL は空リスト。
+ *
+ * \return \a node を先頭とする新しいリスト (つまり \a node)。
+ */
 struct grass_value_node *
-grass_get_nth_value_node(struct grass_value_node *node, size_t n)
+grass_cons_value_node(struct grass_value_node *node, struct grass_value_node *list)
 {
-	assert(n > 0);
+	assert(node != NULL);
 
-	while((--n > 0) && (node != NULL))
+	if((list != NULL) && (list->rest != GRASS_NO_NODE)
+	&& (list->size == GRASS_NODE_PTR(list->rest)->size))
 	{
-		node = node->next;
+		node->left = GRASS_NODE_REF(list);
+		node->right = list->rest;
+		node->rest = GRASS_NODE_PTR(list->rest)->rest;
+		node->size = 2 * list->size + 1;
+	}
+	else
+	{
+		node->left = GRASS_NO_NODE;
+		node->right = GRASS_NO_NODE;
+		node->rest = GRASS_NODE_REF(list);
+		node->size = 1;
 	}
 
 	return node;
 }
 
 
+/*!
+ * 先頭の要素を除いたリストを返す。
+ *
+ * 先頭が木の場合、その左の部分木は「左の部分木::右の部分木::残り」
+ * というリストの先頭として作られたものなので、それがそのまま答えになる。
+ */
 struct grass_value_node *
-grass_append_value_list(struct grass_value_node *list1, struct grass_value_node *list2)
+grass_value_list_tail(const struct grass_value_node *list)
 {
-	if(list1 == NULL)
+	assert(list != NULL);
+
+	if(list->size == 1)
 	{
-		return list2;
+		return GRASS_NODE_PTR(list->rest);
 	}
 	else
 	{
-		struct grass_value_node *list1_tail;
-		for(list1_tail = list1; list1_tail->next != NULL; list1_tail = list1_tail->next)
-			;
-		list1_tail->next = list2;
-		return list1;
+		return GRASS_NODE_PTR(list->left);
 	}
 }
 
-static int
-grass_apply_to_closure(struct grass_machine *machine,
-                       const struct grass_value *func,
-                       const struct grass_value *arg,
-                       char **error_message)
-{
-	struct grass_value_node *env_node;
-	struct grass_value_node *dump_node;
 
-	assert(machine != NULL);
-	assert(func != NULL);
-	assert(arg != NULL);
-	assert(error_message != NULL);
+/*!
+ * 値リストの \a n 番目のノードを取得する。 O(log n) 。
+ *
+ * \param node 値リスト。
+ * \param n    1始まりのインデックス。
+ *
+ * \return \a n 番目のノード。範囲外の場合は NULL 。
+ */
+struct grass_value_node *
+grass_get_nth_value_node(struct grass_value_node *node, size_t n)
+{
+	size_t i;
+	size_t size;
 
-	assert(func->type == GRASS_VT_CLOSURE);
+	assert(n > 0);
 
-	/* (App(m, n)::C, E, D) → (Cm, (Cn, En)::Em, (C, E)::D)
-	 * 	where E = (C1, E1)::(C2, E2):: ... ::(Ci, Ei)::E' (i = m, n)
-	 */
+	/* 該当する木を探す */
+	i = n - 1;
+	while((node != NULL) && (i >= node->size))
+	{
+		i -= node->size;
+		node = GRASS_NODE_PTR(node->rest);
+	}
+	if(node == NULL)
+	{
+		return NULL;
+	}
 
-	env_node = grass_create_value_node(arg);
-	if(env_node == NULL)
+	/* 木の中を辿る */
+	size = node->size;
+	while(i > 0)
 	{
-		*error_message = strerror(errno);
-		return 0;
+		size /= 2; /* 部分木のサイズ */
+		if(i <= size)
+		{
+			node = GRASS_NODE_PTR(node->left);
+			i -= 1;
+		}
+		else
+		{
+			node = GRASS_NODE_PTR(node->right);
+			i -= 1 + size;
+		}
 	}
 
-	dump_node = grass_create_closure_node(
-			  machine->code->next,
-			  machine->env);
-	if(dump_node == NULL)
+	return node;
+}
+
+
+/*!
+ * 値リストの \a n 番目のノードを、範囲を確かめずに取得する。
+ *
+ * grass_get_nth_value_node() と同じだが、 \a n が範囲内であることを
+ * 呼び出し側が保証する (grass_program 参照) 。
+ *
+ * \param node 値リスト。
+ * \param n    1始まりのインデックス。
+ *
+ * \return \a n 番目のノード。
+ */
+struct grass_value_node *
+grass_get_verified_value_node(struct grass_value_node *node, size_t n)
+{
+	size_t i;
+	size_t size;
+
+	assert(n > 0);
+
+	/* 該当する木を探す */
+	i = n - 1;
+	while(i >= node->size)
 	{
-		*error_message = strerror(errno);
-		return 0;
+		i -= node->size;
+		node = GRASS_NODE_PTR(node->rest);
+		assert(node != NULL);
 	}
 
-	machine->code = func->content.closure.code;
-	env_node->next = func->content.closure.env;
-	machine->env = env_node;
-	dump_node->next = machine->dump;
-	machine->dump = dump_node;
+	/* 木の中を辿る */
+	size = node->size;
+	while(i > 0)
+	{
+		size /= 2; /* 部分木のサイズ */
+		if(i <= size)
+		{
+			node = GRASS_NODE_PTR(node->left);
+			i -= 1;
+		}
+		else
+		{
+			node = GRASS_NODE_PTR(node->right);
+			i -= 1 + size;
+		}
+	}
 
-	return 1;
+	return node;
 }
 
+
 static int
 grass_apply_to_out(struct grass_machine *machine,
-                   const struct grass_value *func,
-                   const struct grass_value *arg,
+                   grass_value func,
+                   grass_value arg,
                    char **error_message)
 {
-	struct grass_value_node *env_node;
-	int n;
+	struct grass_value_node *env;
 
 	assert(machine != NULL);
-	assert(func != NULL);
-	assert(arg != NULL);
 	assert(error_message != NULL);
 
-	assert(func->type == GRASS_VT_OUT);
+	assert(GRASS_VALUE_TYPE(func) == GRASS_VT_OUT);
 
-	if(arg->type != GRASS_VT_NUMERIC)
+	if(GRASS_VALUE_TYPE(arg) != GRASS_VT_NUMERIC)
 	{
 		*error_message = "runtime error: non-numeric value could not applyed to Out.";
 		return 0;
 	}
-	n = arg->content.numeric.n;
-
-	putchar(n);
 
-	env_node = grass_create_numeric_node(n);
-	if(env_node == NULL)
+	/* Out は引数をそのまま返す */
+	env = grass_push_env_cell(machine, GRASS_OUT_RESULT(machine->io, arg), machine->env);
+	if(env == NULL)
 	{
-		*error_message = strerror(errno);
+		*error_message = GRASS_HEAP_ERROR_MESSAGE();
 		return 0;
 	}
-	machine->code = machine->code->next;
-	env_node->next = machine->env;
-	machine->env = env_node;
+	machine->code++;
+	machine->env = env;
 
 	return 1;
 }
@@ -315,36 +425,32 @@ grass_apply_to_out(struct grass_machine *machine,
 
 static int
 grass_apply_to_in(struct grass_machine *machine,
-                  const struct grass_value *func,
-                  const struct grass_value *arg,
+                  grass_value func,
+                  grass_value arg,
                   char **error_message)
 {
-	struct grass_value_node *env_node;
+	struct grass_value_node *env;
 	int ch;
 
 	assert(machine != NULL);
-	assert(func != NULL);
-	assert(arg != NULL);
 	assert(error_message != NULL);
 
-	assert(func->type == GRASS_VT_IN);
+	assert(GRASS_VALUE_TYPE(func) == GRASS_VT_IN);
 
-	ch = getchar();
+	ch = machine->io->get_char(machine->io->context);
 	if(ch == EOF)
 	{
 		*error_message = "runtime error: unexpected EOF.";
 		return 0;
 	}
-	env_node = grass_create_numeric_node(ch);
-
-	if(env_node == NULL)
+	env = grass_push_env_cell(machine, GRASS_NUMERIC_VALUE(ch), machine->env);
+	if(env == NULL)
 	{
-		*error_message = strerror(errno);
+		*error_message = GRASS_HEAP_ERROR_MESSAGE();
 		return 0;
 	}
-	machine->code = machine->code->next;
-	env_node->next = machine->env;
-	machine->env = env_node;
+	machine->code++;
+	machine->env = env;
 
 	return 1;
 }
@@ -352,35 +458,31 @@ grass_apply_to_in(struct grass_machine *machine,
 
 static int
 grass_apply_to_succ(struct grass_machine *machine,
-                    const struct grass_value *func,
-                    const struct grass_value *arg,
+                    grass_value func,
+                    grass_value arg,
                     char **error_message)
 {
-	struct grass_value_node *env_node;
+	struct grass_value_node *env;
 
 	assert(machine != NULL);
-	assert(func != NULL);
-	assert(arg != NULL);
 	assert(error_message != NULL);
 
-	assert(func->type == GRASS_VT_SUCC);
+	assert(GRASS_VALUE_TYPE(func) == GRASS_VT_SUCC);
 
-	if(arg->type != GRASS_VT_NUMERIC)
+	if(GRASS_VALUE_TYPE(arg) != GRASS_VT_NUMERIC)
 	{
 		*error_message = "runtime error: non-numeric value could not applyed to Succ.";
 		return 0;
 	}
 
-	env_node = grass_create_numeric_node((arg->content.numeric.n + 1) & 0xff);
-
-	if(env_node == NULL)
+	env = grass_push_env_cell(machine, GRASS_SUCC_RESULT(arg), machine->env);
+	if(env == NULL)
 	{
-		*error_message = strerror(errno);
+		*error_message = GRASS_HEAP_ERROR_MESSAGE();
 		return 0;
 	}
-	machine->code = machine->code->next;
-	env_node->next = machine->env;
-	machine->env = env_node;
+	machine->code++;
+	machine->env = env;
 
 	return 1;
 }
@@ -388,66 +490,55 @@ grass_apply_to_succ(struct grass_machine *machine,
 
 static int
 grass_apply_to_numeric(struct grass_machine *machine,
-                       const struct grass_value *func,
-                       const struct grass_value *arg,
+                       grass_value func,
+                       grass_value arg,
                        char **error_message)
 {
-	struct grass_value_node *env_node;
+	struct grass_value_node *env;
 
 	assert(machine != NULL);
-	assert(func != NULL);
-	assert(arg != NULL);
 	assert(error_message != NULL);
 
-	assert(func->type == GRASS_VT_NUMERIC);
+	assert(GRASS_VALUE_TYPE(func) == GRASS_VT_NUMERIC);
 
-	if(arg->type != GRASS_VT_NUMERIC)
+	if(GRASS_VALUE_TYPE(arg) != GRASS_VT_NUMERIC)
 	{
 		*error_message = "runtime error: non-numeric value could not applyed to numeric value.";
 		return 0;
 	}
 	//assert(!"TODO: implementation");
 
-	if(func->content.numeric.n == arg->content.numeric.n)
-	{
-		env_node = grass_create_true_node();
-	}
-	else
-	{
-		env_node = grass_create_false_node();
-	}
+	env = grass_push_env_cell(machine,
+	                          GRASS_NUMERIC_RESULT(func, arg, machine->true_value,
+	                                               machine->false_value),
+	                          machine->env);
 
-	if(env_node == NULL)
+	if(env == NULL)
 	{
-		*error_message = strerror(errno);
+		*error_message = GRASS_HEAP_ERROR_MESSAGE();
 		return 0;
 	}
-	machine->code = machine->code->next;
-	env_node->next = machine->env;
-	machine->env = env_node;
+	machine->code++;
+	machine->env = env;
 
 	return 1;
 }
 
 /*!
- * \a func に \a arg を適用し、抽象機械の状態を更新する。
+ * プリミティブ \a func に \a arg を適用し、抽象機械の状態を更新する。
+ * クロージャの適用は抽象機械 (grass_run_machine()) 自身が行う。
  */
 int
-grass_apply(struct grass_machine *machine,
-            const struct grass_value *func,
-            const struct grass_value *arg,
-            char **error_message)
+grass_apply_primitive(struct grass_machine *machine,
+                      grass_value func,
+                      grass_value arg,
+                      char **error_message)
 {
 	assert(machine != NULL);
-	assert(func != NULL);
-	assert(arg != NULL);
 	assert(error_message != NULL);
 
-	switch(func->type)
+	switch(GRASS_VALUE_TYPE(func))
 	{
-	case GRASS_VT_CLOSURE:
-		return grass_apply_to_closure(machine, func, arg, error_message);
-
 	case GRASS_VT_OUT:
 		return grass_apply_to_out(machine, func, arg, error_message);
 
@@ -471,15 +562,28 @@ grass_apply(struct grass_machine *machine,
 
 
 static void
-grass_dump_value(const struct grass_value *value)
+grass_dump_value(const struct grass_program *program, grass_value value)
 {
-	switch(value->type)
+	const struct grass_closure *closure;
+
+	switch(GRASS_VALUE_TYPE(value))
 	{
 	case GRASS_VT_CLOSURE:
+		closure = GRASS_CLOSURE(value);
 		printf("[");
-		grass_dump_instruction_list(value->content.closure.code);
+		if(closure->num_args > 1)
+		{
+			/* (Abs(k-1, C')::ε, E) の形で出力する。 */
+			printf("(Abs(%zu, ", (size_t)closure->num_args - 1);
+			grass_dump_code(program, closure->code);
+			printf(") :: ε)");
+		}
+		else
+		{
+			grass_dump_code(program, closure->code);
+		}
 		printf(", ");
-		grass_dump_value_list(value->content.closure.env);
+		grass_dump_value_list(program, GRASS_NODE_PTR(closure->env));
 		printf("]");
 		break;
 
@@ -496,21 +600,26 @@ grass_dump_value(const struct grass_value *value)
 		break;
 
 	case GRASS_VT_NUMERIC:
-		printf("Numeric{%d}", value->content.numeric.n);
+		printf("Numeric{%d}", GRASS_NUMERIC(value));
+		break;
+
+	default:
+		assert(0); /* BUG! */
 		break;
 	}
 }
 
 
 void
-grass_dump_value_list(const struct grass_value_node *value_list)
+grass_dump_value_list(const struct grass_program *program,
+                      const struct grass_value_node *value_list)
 {
 	printf("(");
 	while(value_list != NULL)
 	{
-		grass_dump_value(&value_list->value);
+		grass_dump_value(program, value_list->value);
 		printf(" :: ");
-		value_list = value_list->next;
+		value_list = grass_value_list_tail(value_list);
 	}
 	printf("ε)");
 }
@@ -13,72 +13,179 @@
 #include <stddef.h>
 #include "grass_fwd.h"
 
+/*! 値の種類。 grass_value の下位 GRASS_VALUE_TAG_BITS ビットに入る。 */
+enum grass_value_type
+{
+	GRASS_VT_CLOSURE = 0, /*!< \brief クロージャ */
+	GRASS_VT_NUMERIC = 1, /*!< \brief 数値型 (兼同値判定関数) */
+	GRASS_VT_OUT     = 2, /*!< \brief Outプリミティブ */
+	GRASS_VT_IN      = 3, /*!< \brief Inプリミティブ */
+	GRASS_VT_SUCC    = 4  /*!< \brief Succプリミティブ */
+};
+
+#if defined(GRASS_COMPACT_HEAP)
+
+/*! アリーナ (grass_arena.h) の先頭。ヒープ上のオフセットはここからのバイト数。 */
+extern char *grass_arena_base;
+
+/*! ヒープ上のオブジェクトが持つ整数。 */
+typedef uint32_t grass_heap_uint;
+
+/*! ヒープ上のノードへの参照。アリーナ先頭からのオフセットで、 0 は NULL 。 */
+typedef uint32_t grass_node_ref;
+
+/*! \brief 参照 \a ref が指すノード。 */
+#define GRASS_NODE_PTR(ref) \
+	((ref)? (struct grass_value_node *)(grass_arena_base + (ref)): NULL)
+
+/*! \brief ノード \a ptr への参照。 */
+#define GRASS_NODE_REF(ptr) \
+	((ptr)? (grass_node_ref)((const char *)(ptr) - grass_arena_base): 0)
+
+/*! \brief クロージャの値 \a v が指す struct grass_closure 。 */
+#define GRASS_CLOSURE(v) ((const struct grass_closure *)(grass_arena_base + (v)))
+
+/*! \brief struct grass_closure \a ptr を指す値。 */
+#define GRASS_CLOSURE_VALUE(ptr) ((grass_value)((const char *)(ptr) - grass_arena_base))
+
+#else /* defined(GRASS_COMPACT_HEAP) */
+
+typedef size_t grass_heap_uint;
+typedef struct grass_value_node *grass_node_ref;
+
+#define GRASS_NODE_PTR(ref) (ref)
+#define GRASS_NODE_REF(ptr) (ptr)
+#define GRASS_CLOSURE(v) ((const struct grass_closure *)(v))
+#define GRASS_CLOSURE_VALUE(ptr) ((grass_value)(ptr))
+
+#endif /* defined(GRASS_COMPACT_HEAP) */
+
+/*! 空のリストを表す参照。 */
+#define GRASS_NO_NODE ((grass_node_ref)0)
+
+
 /*!
  * クロージャ。
- * コードと環境の組。
+ * コードと環境の組。ヒープ上に置かれ、 grass_value はそのアドレス
+ * (GRASS_COMPACT_HEAP の場合はオフセット) を持つ。
+ *
+ * num_args が 2 以上のものは、Abs(num_args, C') に引数を部分適用したもの、
+ * つまり (Abs(num_args-1, C')::ε, E) を表す。命令を作らずにカリー化を
+ * 表現するため、元のコードのまま残りの引数の数を数える。
  */
 struct grass_closure
 {
-	struct grass_instruction_node *code;
-	struct grass_value_node *env;
+	grass_heap_uint code;     /*!< \brief grass_program::ops 中の位置 */
+	grass_heap_uint num_args; /*!< \brief 残りの引数の数 */
+	grass_node_ref env;
+#if defined(GRASS_REFCOUNT_HEAP)
+	grass_heap_uint refs; /*!< \brief 参照カウント (grass_arena.h 参照) */
+#endif
 };
 
+
+/*! grass_value の種類を表すビット数。 */
+#define GRASS_VALUE_TAG_BITS 3
+/*! grass_value の種類を表すビットのマスク。 */
+#define GRASS_VALUE_TAG_MASK (((grass_value)1 << GRASS_VALUE_TAG_BITS) - 1)
+
+/*! 値が無いことを表す。 (クロージャの NULL ポインタに当たる) */
+#define GRASS_NO_VALUE ((grass_value)0)
+
+/*! 値 \a v の種類 (enum grass_value_type) 。メモリは読まない。 */
+#define GRASS_VALUE_TYPE(v) ((enum grass_value_type)((v) & GRASS_VALUE_TAG_MASK))
+
+/*! \brief 値 \a v がクロージャか。 */
+#define GRASS_IS_CLOSURE(v) (GRASS_VALUE_TYPE(v) == GRASS_VT_CLOSURE)
+
+/*! \brief 数値 \a n (0〜255) を表す即値。 */
+#define GRASS_NUMERIC_VALUE(n) \
+	(((grass_value)(n) << GRASS_VALUE_TAG_BITS) | GRASS_VT_NUMERIC)
+
+/*! \brief 数値の値 \a v が持つ数値。 */
+#define GRASS_NUMERIC(v) ((int)((v) >> GRASS_VALUE_TAG_BITS))
+
+/*! \brief Outプリミティブを表す即値。 */
+#define GRASS_OUT_VALUE ((grass_value)GRASS_VT_OUT)
+/*! \brief Inプリミティブを表す即値。 */
+#define GRASS_IN_VALUE ((grass_value)GRASS_VT_IN)
+/*! \brief Succプリミティブを表す即値。 */
+#define GRASS_SUCC_VALUE ((grass_value)GRASS_VT_SUCC)
+
 /*!
- * 数値型。
- * 関数としては、自身が持つ数値と引数が持つ数値が等しいかの判定を行う。
+ * \brief Out を数値 \a arg に適用する。 \a io に出力し、 \a arg を返す。
  */
-struct grass_numeric
-{
-	int n;
-};
-
+#define GRASS_OUT_RESULT(io, arg) \
+	((io)->put_char(GRASS_NUMERIC(arg), (io)->context), (arg))
 
-/*! 値の種類。 */
-enum grass_value_type
-{
-	GRASS_VT_CLOSURE, /*!< \brief クロージャ */
-	GRASS_VT_OUT,     /*!< \brief Outプリミティブ */
-	GRASS_VT_IN,      /*!< \brief Inプリミティブ */
-	GRASS_VT_SUCC,    /*!< \brief Succプリミティブ */
-	GRASS_VT_NUMERIC  /*!< \brief 数値型 (兼同値判定関数) */
-};
+/*! \brief Succ を数値 \a arg に適用した値。 255 の次は 0 。 */
+#define GRASS_SUCC_RESULT(arg) GRASS_NUMERIC_VALUE((GRASS_NUMERIC(arg) + 1) & 0xff)
 
+/*!
+ * \brief 数値 \a func を数値 \a arg に適用した値。
+ * 数値同士は即値をそのまま比べればよい。
+ */
+#define GRASS_NUMERIC_RESULT(func, arg, true_value, false_value) \
+	(((func) == (arg))? (true_value): (false_value))
 
 /*!
- * すべての値関連の型をひとまとめにしたもの。
+ * プリミティブ \a func を \a arg に、その場で適用した値。
+ *
+ * In と、エラーになる適用 (\a arg が数値でない) では GRASS_NO_VALUE になる。
+ * それらは grass_apply_primitive() に任せること。
+ * \a func が定数なら、種類の分岐は畳み込まれる。引数は何度か評価される。
+ *
+ * \param io          Out の出力先 (struct grass_io *) 。
+ * \param true_value  数値が等しかった時の値。
+ * \param false_value 数値が等しくなかった時の値。
  */
-struct grass_value
-{
-	enum grass_value_type type;
-	union /* Out, In, Succ には特に保存しておく値なし。 */
-	{
-		struct grass_closure closure; /*!< \brief クロージャ */
-		struct grass_numeric numeric; /*!< \brief 数値 */
-	} content;
-};
+#define GRASS_PRIMITIVE_RESULT(func, arg, io, true_value, false_value)            \
+	((GRASS_VALUE_TYPE(arg) != GRASS_VT_NUMERIC)? GRASS_NO_VALUE:              \
+	 (GRASS_VALUE_TYPE(func) == GRASS_VT_OUT)? GRASS_OUT_RESULT((io), (arg)):  \
+	 (GRASS_VALUE_TYPE(func) == GRASS_VT_SUCC)? GRASS_SUCC_RESULT(arg):        \
+	 (GRASS_VALUE_TYPE(func) == GRASS_VT_NUMERIC)?                             \
+	 GRASS_NUMERIC_RESULT((func), (arg), (true_value), (false_value)):         \
+	 GRASS_NO_VALUE)
 
 
 /*!
  * 値型のリストを構成するノード。
+ *
+ * リスト (環境) は skew binary random-access list として表現する。
+ * つまり、リストはサイズ 2^k - 1 の完全二分木の列であり、各ノードは
+ * 「自身を根とする木」と「その木を先頭とするリスト」を同時に表す。
+ * 木の要素は前順 (根 → left → right) に並ぶ。
+ *
+ * ノードは一度リストに繋いだら変更しないので、複数のクロージャ間で
+ * 自由に共有できる。値は1ワードなので、ノードに直接持たせる。
+ * 先頭への追加 (grass_cons_value_node()) と
+ * 先頭の除去 (grass_value_list_tail()) は O(1) 、
+ * インデックスによる参照 (grass_get_nth_value_node()) は O(log n) 。
  */
 struct grass_value_node
 {
-	struct grass_value value;
-	struct grass_value_node *next;
+	grass_value value;
+	grass_node_ref left;  /*!< \brief 左の部分木。 size が 1 なら NULL */
+	grass_node_ref right; /*!< \brief 右の部分木。 size が 1 なら NULL */
+	grass_node_ref rest;  /*!< \brief この木に続く残りのリスト */
+	grass_heap_uint size; /*!< \brief この木の要素数 */
+#if defined(GRASS_REFCOUNT_HEAP)
+	grass_heap_uint refs; /*!< \brief 参照カウント。環境スタック上のセルでは使わない */
+#endif
 };
 
 
 /*!
- * \brief 値型のノードを複製する。
+ * \brief 値を持つノードを作成する。
  */
 struct grass_value_node *
-grass_create_value_node(const struct grass_value *node);
+grass_create_value_node(grass_value value);
 
 /*!
- * \brief 内容としてクロージャを持つノードを作成する。
+ * \brief クロージャの値を作成する。
  */
-struct grass_value_node *
-grass_create_closure_node(struct grass_instruction_node *code, struct grass_value_node *env);
+grass_value
+grass_create_closure_value(size_t code, size_t num_args, struct grass_value_node *env);
 
 /*!
  * \brief 内容としてOutプリミティブを持つノードを作成する。
@@ -104,6 +211,43 @@ grass_create_succ_func_node(void);
 struct grass_value_node *
 grass_create_numeric_node(int n);
 
+/*!
+ * \brief クロージャ \a func に引数 \a arg を部分適用したクロージャを作成する。
+ */
+grass_value
+grass_create_partial_application(grass_value func, grass_value arg);
+
+/*!
+ * \brief \a env の一部の値だけを捕捉したクロージャを作成する。
+ */
+grass_value
+grass_create_flat_closure(size_t code, size_t num_args, struct grass_value_node *env,
+                          const size_t *indices, size_t count);
+
+/*!
+ * \brief Church 表現の true を作成する。
+ */
+grass_value
+grass_create_true_value(const struct grass_program *program);
+
+/*!
+ * \brief Church 表現の false を作成する。
+ */
+grass_value
+grass_create_false_value(const struct grass_program *program);
+
+/*!
+ * \brief \a node を \a list の先頭に繋ぎ、新しいリストを返す。
+ */
+struct grass_value_node *
+grass_cons_value_node(struct grass_value_node *node, struct grass_value_node *list);
+
+/*!
+ * \brief 値リストの先頭を除いたリストを取得する。
+ */
+struct grass_value_node *
+grass_value_list_tail(const struct grass_value_node *list);
+
 /*!
  * \brief 値リストの \a n 番目のノードを取得する。
  */
@@ -111,23 +255,24 @@ struct grass_value_node *
 grass_get_nth_value_node(struct grass_value_node *node, size_t n);
 
 /*!
- * \brief \a list1 と \a list2 を結合する。
+ * \brief 値リストの \a n 番目のノードを、範囲を確かめずに取得する。
  */
 struct grass_value_node *
-grass_append_value_list(struct grass_value_node *list1, struct grass_value_node *list2);
+grass_get_verified_value_node(struct grass_value_node *node, size_t n);
 
 /*!
- * \a func に \a arg を適用し、抽象機械の状態を更新する。
+ * プリミティブ \a func に \a arg を適用し、抽象機械の状態を更新する。
  */
 int
-grass_apply(struct grass_machine *machine,
-            const struct grass_value *func,
-            const struct grass_value *arg,
-            char **error_message);
+grass_apply_primitive(struct grass_machine *machine,
+                      grass_value func,
+                      grass_value arg,
+                      char **error_message);
 
 
-/*! \brief 値のリスト(環境 or Dump)を出力する。 */
+/*! \brief 値のリスト(環境)を出力する。 */
 void
-grass_dump_value_list(const struct grass_value_node *value_list);
+grass_dump_value_list(const struct grass_program *program,
+                      const struct grass_value_node *value_list);
 
 #endif /* grass_value_H_ */
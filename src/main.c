@@ -15,6 +15,9 @@
  */
 #include "grass.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <locale.h>
@@ -28,6 +31,12 @@ struct prog_options
 	int trace;   /*!< traceオプションに対応。 */
 	int step;    /*!< stopオプションに対応。 */
 	int no_exec; /*!< noexecオプションに対応。 */
+	int emit_c;  /*!< emit-cオプションに対応。 */
+	int stats;   /*!< statsオプションに対応。 */
+	const char *engine; /*!< engineオプションに対応。 */
+	size_t max_steps;   /*!< max-stepsオプションに対応。無指定なら0。 */
+	size_t max_heap;    /*!< heap-limitオプションに対応。無指定なら0。 */
+	struct grass_gc_options gc; /*!< gc-*オプションと GRASS_GC_* 環境変数に対応。 */
 
 	const char *infile; /*!< 入力(ソース)ファイル。無指定ならNULL。 */
 
@@ -35,6 +44,22 @@ struct prog_options
 	int help_to_stderr; /*!< ヘルプを stderr に出力するか。0の場合は stdout になる。 */
 };
 
+/*! GC の設定の長いオプション。短い形は無い。 */
+enum
+{
+	OPTION_GC_INITIAL_HEAP = 0x100,
+	OPTION_GC_MAX_HEAP,
+	OPTION_GC_THREADS,
+	OPTION_GC_INCREMENTAL
+};
+
+/*! heap-limit オプションの短い形。 GRASS_COMPACT_HEAP でのみ有効。 */
+#if defined(GRASS_COMPACT_HEAP)
+#define HEAP_LIMIT_OPTION "H:"
+#else
+#define HEAP_LIMIT_OPTION ""
+#endif
+
 /*
  * コマンドライン:
  *
@@ -43,6 +68,28 @@ struct prog_options
  *	             結果が表示されるので注意。
  *	--step,   -s ステップ実行を行う。
  *	--noexec, -n ソースを読み込むだけで、実行を行わない。
+ *	--engine=NAME, -e NAME
+ *	             実行エンジンを選ぶ。 trace, step とは併用できない。
+ *	--jit,    -j --engine=jit と同じ。
+ *	--big-step, -b --engine=big-step と同じ。
+ *	--max-steps=N, -m N
+ *	             N ステップで終わらなければエラーにする。
+ *	--stats,  -S 実行後、エンジン名、ステップ数、 CPU 時間 (と GC の統計) を
+ *	             stderr に出力する。
+ *	--heap-limit=BYTES, -H BYTES
+ *	             ヒープの上限。 k, m, g の接尾辞を付けられる。
+ *	             GRASS_COMPACT_HEAP でビルドした場合のみ。
+ *	--gc-initial-heap=BYTES
+ *	             Boehm GC のヒープを最初に BYTES まで広げておく。
+ *	--gc-max-heap=BYTES
+ *	             Boehm GC のヒープの上限。
+ *	--gc-threads=N
+ *	             Boehm GC のマークを N スレッドで行う。
+ *	--gc-incremental
+ *	             Boehm GC をインクリメンタルに動かす (停止時間を短くする)。
+ *	             gc-* は GRASS_GC_* 環境変数でも指定できる
+ *	             (grass_get_gc_environment() 参照)。
+ *	--emit-c, -c 実行せずに、プログラムを C のソースに変換して出力する。
  *	--help,   -h 使い方を出力して終了する。
  */
 static void
@@ -53,6 +100,19 @@ get_options(int argc, char *argv[], struct prog_options *options)
 		{ "trace",  no_argument, NULL, 't' },
 		{ "step",   no_argument, NULL, 's' },
 		{ "noexec", no_argument, NULL, 'n' },
+		{ "engine", required_argument, NULL, 'e' },
+		{ "jit",    no_argument, NULL, 'j' },
+		{ "big-step", no_argument, NULL, 'b' },
+		{ "max-steps", required_argument, NULL, 'm' },
+		{ "stats",  no_argument, NULL, 'S' },
+#if defined(GRASS_COMPACT_HEAP)
+		{ "heap-limit", required_argument, NULL, 'H' },
+#endif
+		{ "gc-initial-heap", required_argument, NULL, OPTION_GC_INITIAL_HEAP },
+		{ "gc-max-heap", required_argument, NULL, OPTION_GC_MAX_HEAP },
+		{ "gc-threads", required_argument, NULL, OPTION_GC_THREADS },
+		{ "gc-incremental", no_argument, NULL, OPTION_GC_INCREMENTAL },
+		{ "emit-c", no_argument, NULL, 'c' },
 		{ "help",   no_argument, NULL, 'h' },
 
 		{ 0 }
@@ -64,13 +124,28 @@ get_options(int argc, char *argv[], struct prog_options *options)
 	options->trace = 0;
 	options->step = 0;
 	options->no_exec = 0;
+	options->emit_c = 0;
+	options->stats = 0;
+	options->engine = GRASS_DEFAULT_ENGINE;
+	options->max_steps = 0;
+	options->max_heap = 0;
+	options->gc.initial_heap = 0;
+	options->gc.max_heap = 0;
+	options->gc.threads = 0;
+	options->gc.incremental = 0;
 	options->infile = NULL;
 	options->help = 0;
 	options->help_to_stderr = 0;
 
+	if(!grass_get_gc_environment(&options->gc))
+	{
+		options->help = 1;
+		options->help_to_stderr = 1;
+	}
+
 	do
 	{
-		switch(getopt_long(argc, argv, "dtsnh", longopts, NULL))
+		switch(getopt_long(argc, argv, "dtsne:jbm:S" HEAP_LIMIT_OPTION "ch", longopts, NULL))
 		{
 		case 'd': /* dump */
 			options->dump = 1;
@@ -88,6 +163,78 @@ get_options(int argc, char *argv[], struct prog_options *options)
 			options->no_exec = 1;
 			break;
 
+		case 'e': /* engine */
+			options->engine = optarg;
+			break;
+
+		case 'j': /* jit */
+			options->engine = "jit";
+			break;
+
+		case 'b': /* big-step */
+			options->engine = "big-step";
+			break;
+
+		case 'm': /* max-steps */
+			{
+				char *end;
+
+				errno = 0;
+				options->max_steps = strtoul(optarg, &end, 10);
+				if((*optarg == '\0') || (*end != '\0') || (errno != 0))
+				{
+					options->help = 1;
+					options->help_to_stderr = 1;
+				}
+			}
+			break;
+
+		case 'S': /* stats */
+			options->stats = 1;
+			break;
+
+#if defined(GRASS_COMPACT_HEAP)
+		case 'H': /* heap-limit */
+			if(!grass_parse_size(optarg, &options->max_heap))
+			{
+				options->help = 1;
+				options->help_to_stderr = 1;
+			}
+			break;
+#endif
+
+		case OPTION_GC_INITIAL_HEAP: /* gc-initial-heap */
+			if(!grass_parse_size(optarg, &options->gc.initial_heap))
+			{
+				options->help = 1;
+				options->help_to_stderr = 1;
+			}
+			break;
+
+		case OPTION_GC_MAX_HEAP: /* gc-max-heap */
+			if(!grass_parse_size(optarg, &options->gc.max_heap))
+			{
+				options->help = 1;
+				options->help_to_stderr = 1;
+			}
+			break;
+
+		case OPTION_GC_THREADS: /* gc-threads */
+			if(!grass_parse_count(optarg, &options->gc.threads))
+			{
+				options->help = 1;
+				options->help_to_stderr = 1;
+			}
+			break;
+
+		case OPTION_GC_INCREMENTAL: /* gc-incremental */
+			options->gc.incremental = 1;
+			break;
+
+		case 'c': /* emit-c */
+			options->emit_c = 1;
+			break;
+
 		case 'h': /* help */
 			options->help = 1;
 			break;
@@ -131,6 +278,8 @@ get_options(int argc, char *argv[], struct prog_options *options)
 static void
 print_usage(FILE *out, const char *prog)
 {
+	const struct grass_engine *const *engine;
+
 	/* 頭回らん。gdgdな文かも。 */
 	fprintf(out,
 		"usage: %s [options..] [infile]\n"
@@ -140,10 +289,154 @@ print_usage(FILE *out, const char *prog)
 		"                (note: lots of texts will be output.)\n"
 		"  -s, --step    run in stepping mode.\n"
 		"  -n, --noexec  parse only. odn't run the program.\n"
+		"  -e, --engine=NAME  run with the execution engine NAME.\n"
+		"                (ignored with -t or -s. see below.)\n"
+		"  -j, --jit     same as --engine=jit.\n"
+		"  -b, --big-step  same as --engine=big-step.\n"
+		"  -m, --max-steps=N  fail if the program does not finish in N steps.\n"
+		"  -S, --stats   print engine, steps, CPU time and GC statistics\n"
+		"                to stderr after running.\n"
+#if defined(GRASS_COMPACT_HEAP)
+		"                (this build keeps every partial application on the heap,\n"
+		"                 so no local closures are reported.)\n"
+#endif
+#if defined(GRASS_COMPACT_HEAP)
+		"  -H, --heap-limit=BYTES  fail if the heap grows beyond BYTES.\n"
+		"                (suffixes k, m and g are allowed. default: 256m)\n"
+		"                a collection copies live objects into up to BYTES more,\n"
+		"                so the heap can use twice BYTES (the peak in --stats\n"
+		"                includes it).\n"
+#endif
+		"      --gc-initial-heap=BYTES  grow the GC heap to BYTES at startup.\n"
+		"      --gc-max-heap=BYTES      fail if the GC heap grows beyond BYTES.\n"
+		"      --gc-threads=N  mark with N threads (if the GC supports it).\n"
+		"      --gc-incremental  collect incrementally to shorten pauses.\n"
+		"                (the --gc-* options can also be given as GRASS_GC_INITIAL_HEAP,\n"
+		"                 GRASS_GC_MAX_HEAP, GRASS_GC_THREADS and GRASS_GC_INCREMENTAL.)\n"
+		"  -c, --emit-c  output the program as C source instead of running it.\n"
 		"  -h, --help    display this help and exit.\n"
+		"\n"
+		"engines:\n"
 		,
 		prog
 	);
+	for(engine = grass_engines(); *engine != NULL; engine++)
+	{
+		fprintf(out, "  %-10s %s\n", (*engine)->name, (*engine)->description);
+	}
+}
+
+
+/*!
+ * トレースモードかステップ実行モードで、プログラムを最後まで実行する。
+ *
+ * \param options  実行オプション。
+ * \param program  プログラム。
+ *
+ * \return そのまま main() の戻り値になる。
+ */
+static int
+trace(const struct prog_options *options, const struct grass_program *program)
+{
+	struct grass_machine *machine;
+	char *msg;
+
+	machine = grass_create_machine(program, &msg);
+	if(machine == NULL)
+	{
+		printf("%s\n", msg);
+		return 1;
+	}
+
+	while(!grass_machine_done(machine))
+	{
+		if(options->trace)
+		{
+			grass_dump_machine(machine);
+		}
+		if(options->step)
+		{
+			printf("hit enter key.");
+			fflush(stdout);
+			getchar();
+		}
+		if(!grass_step_machine(machine, &msg))
+		{
+			printf("%s\n", msg);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*!
+ * 選択したエンジンで、プログラムを最後まで実行する。
+ *
+ * \param options  実行オプション。
+ * \param program  プログラム。
+ *
+ * \return そのまま main() の戻り値になる。
+ */
+static int
+execute(const struct prog_options *options, const struct grass_program *program)
+{
+	const struct grass_engine *engine;
+	struct grass_engine_limits limits;
+	struct grass_engine_stats stats;
+	char *msg;
+	int result;
+
+	engine = grass_find_engine(options->engine);
+	if(engine == NULL)
+	{
+		printf("unknown engine: %s\n", options->engine);
+		return 1;
+	}
+
+	limits.max_steps = options->max_steps;
+	limits.max_heap = options->max_heap;
+	result = grass_run_engine(engine, program, NULL, &limits, &stats, &msg);
+	if(!result)
+	{
+		printf("%s\n", msg);
+	}
+
+	if(options->stats)
+	{
+		fflush(stdout);
+		fprintf(stderr,
+			"engine: %s\n"
+			"steps:  %zu\n"
+			"cpu:    %.3f s\n",
+			engine->name, stats.steps, stats.cpu_seconds);
+		if(stats.peak_heap != 0)
+		{
+			fprintf(stderr,
+				"gc:     %zu (%.3f s, max pause %.3f ms)\n"
+				"heap:   %zu KiB peak\n",
+				stats.collections, stats.gc_seconds,
+				stats.gc_max_pause * 1000.0, stats.peak_heap >> 10);
+		}
+		if(stats.gc_mark_seconds != 0.0)
+		{
+			fprintf(stderr, "mark:   %.3f s\n", stats.gc_mark_seconds);
+		}
+#if defined(GRASS_COMPACT_HEAP)
+		/* コンパクトなヒープでは、部分適用は常にヒープに作る */
+		fprintf(stderr, "local:  off (not supported with the compact heap)\n");
+#else
+		if(stats.local_closures != 0)
+		{
+			fprintf(stderr,
+				"local:  %zu partial applications (%zu heap allocations avoided)\n",
+				stats.local_closures, 2 * stats.local_closures);
+		}
+#endif
+	}
+
+	return result? 0: 1;
 }
 
 
@@ -157,6 +450,7 @@ static int
 run(const struct prog_options *options, FILE *in)
 {
 	struct grass_instruction_node *code;
+	struct grass_program *program;
 	char *error_messsage;
 
 	code = grass_parse_source(in, &error_messsage);
@@ -180,34 +474,37 @@ run(const struct prog_options *options, FILE *in)
 		puts("");
 	}
 
-	if(!options->no_exec)
+	if(options->emit_c)
 	{
-		struct grass_machine *machine;
 		char *msg;
 
-		machine = grass_create_machine(code);
-
-		while(!grass_machine_done(machine))
+		if(!grass_emit_c(stdout, code, &msg))
 		{
-			if(options->trace)
-			{
-				grass_dump_machine(machine);
-			}
-			if(options->step)
-			{
-				printf("hit enter key.");
-				fflush(stdout);
-				getchar();
-			}
-			if(!grass_step_machine(machine, &msg))
-			{
-				printf("%s\n", msg);
-				return 1;
-			}
+			printf("%s\n", msg);
+			return 1;
 		}
+		return 0;
+	}
+	if(options->no_exec)
+	{
+		return 0;
 	}
 
-	return 0;
+	program = grass_compile_program(code, &error_messsage);
+	if(program == NULL)
+	{
+		printf("%s\n", error_messsage);
+		return 1;
+	}
+	/* 命令ノードはバイトコードに変換したので、もう使わない */
+	grass_free_instruction_nodes();
+
+	if(options->trace || options->step)
+	{
+		return trace(options, program);
+	}
+
+	return execute(options, program);
 }
 
 
@@ -230,6 +527,8 @@ int main(int argc, char *argv[])
 		return (options.help_to_stderr? 1: 0);
 	}
 
+	grass_init_gc(&options.gc);
+
 	if(options.infile == NULL)
 	{
 		in = stdin;
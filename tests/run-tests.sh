@@ -0,0 +1,118 @@
+#!/bin/sh
+# Grass の回帰テスト。
+#
+# このディレクトリの NAME.grass をそれぞれ実行エンジンごとに実行し、
+# 結果を次のファイルと比べる。 NAME.grass 以外は省略できる。
+# 	NAME.out     標準出力 (省略時は空。エラーメッセージも標準出力に出る)
+# 	NAME.status  終了ステータス (省略時は 0)
+# 	NAME.in      標準入力 (省略時は空)
+# 	NAME.args    grass に渡すオプション
+#
+# 環境変数:
+# 	GRASS         grass のパス (省略時は ../src/grass)
+# 	GRASS_ENGINES 試す実行エンジン (省略時は machine jit big-step)
+# 	GRASS_CC, GRASS_CFLAGS, GRASS_LIBS
+# 	              設定されていれば、 --emit-c の出力をこれでコンパイルして
+# 	              実行したものも比べる。 NAME.args があるテストは除く。
+# 	GRASS_TEST_GC_STRESS
+# 	              空でなければ、 Boehm GC に毎回完全な回収を、インクリメンタルに、
+# 	              頻繁に行わせる。型記述子 (grass_arena.c) が漏らしたポインタの
+# 	              先が回収されれば、出力が壊れるか異常終了する。
+#
+# -H を含むテストは、 grass が --heap-limit を持たない場合 (コンパクトな
+# ヒープでないビルド) は飛ばす。
+
+srcdir=${srcdir:-.}
+GRASS=${GRASS:-../src/grass}
+GRASS_ENGINES=${GRASS_ENGINES:-"machine jit big-step"}
+
+if test -n "$GRASS_TEST_GC_STRESS"; then
+	GC_FULL_FREQUENCY=1
+	GC_ENABLE_INCREMENTAL=1
+	GC_FREE_SPACE_DIVISOR=100
+	export GC_FULL_FREQUENCY GC_ENABLE_INCREMENTAL GC_FREE_SPACE_DIVISOR
+fi
+
+work=`mktemp -d "${TMPDIR:-/tmp}/grass-tests.XXXXXX"` || exit 1
+trap 'rm -rf "$work"' 0 1 2 15
+
+if "$GRASS" --help 2>&1 | grep -e --heap-limit >/dev/null; then
+	have_heap_limit=yes
+else
+	have_heap_limit=no
+fi
+
+passed=0
+failed=0
+skipped=0
+
+# check NAME ENGINE STATUS
+# $work/stdout と終了ステータス STATUS を期待値と比べる。
+check()
+{
+	expected_status=0
+	if test -f "$srcdir/$1.status"; then
+		expected_status=`cat "$srcdir/$1.status"`
+	fi
+	expected_out=/dev/null
+	if test -f "$srcdir/$1.out"; then
+		expected_out="$srcdir/$1.out"
+	fi
+
+	if test "$3" = "$expected_status" && cmp -s "$expected_out" "$work/stdout"; then
+		echo "PASS: $1 ($2)"
+		passed=`expr $passed + 1`
+	else
+		echo "FAIL: $1 ($2): exit status $3, expected $expected_status"
+		diff "$expected_out" "$work/stdout"
+		failed=`expr $failed + 1`
+	fi
+}
+
+for program in "$srcdir"/*.grass; do
+	name=`basename "$program" .grass`
+	args=
+	if test -f "$srcdir/$name.args"; then
+		args=`cat "$srcdir/$name.args"`
+	fi
+	input=/dev/null
+	if test -f "$srcdir/$name.in"; then
+		input="$srcdir/$name.in"
+	fi
+
+	case " $args " in
+	*" -H "*)
+		if test $have_heap_limit = no; then
+			echo "SKIP: $name (no --heap-limit)"
+			skipped=`expr $skipped + 1`
+			continue
+		fi
+		;;
+	esac
+
+	for engine in $GRASS_ENGINES; do
+		"$GRASS" -e $engine $args "$program" <"$input" >"$work/stdout"
+		check $name $engine $?
+	done
+
+	if test -z "$GRASS_CC" || test -n "$args"; then
+		continue
+	fi
+	if "$GRASS" --emit-c "$program" >"$work/program.c"; then
+		if ! eval "$GRASS_CC $GRASS_CFLAGS -o \"\$work/program\" \"\$work/program.c\" $GRASS_LIBS"; then
+			echo "FAIL: $name (emit-c): compile error"
+			failed=`expr $failed + 1`
+			continue
+		fi
+		"$work/program" <"$input" >"$work/stdout"
+		check $name emit-c $?
+	else
+		# 読み込みのエラー。メッセージは出力先に出る
+		status=$?
+		mv "$work/program.c" "$work/stdout"
+		check $name emit-c $status
+	fi
+done
+
+echo "$passed passed, $failed failed, $skipped skipped"
+test $failed -eq 0